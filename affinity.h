@@ -0,0 +1,321 @@
+#ifndef MTH5_AFFINITY_H_
+#define MTH5_AFFINITY_H_
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// NOTE(chogan): Worker placement policies. The order of `Affinity::cpus`
+// decides where worker i runs: worker i is pinned to cpus[i % cpus.size()].
+enum class AffinityPolicy {
+  kNone,     // Let the scheduler float threads (the original behavior)
+  kCompact,  // Fill SMT siblings, then cores, then sockets
+  kScatter,  // Round robin across sockets, physical cores before siblings
+  kPhysical, // One CPU per physical core, no SMT siblings
+  kList,     // Explicit CPU list from the command line
+};
+
+struct CpuInfo {
+  int cpu;
+  int package;
+  int core;
+  // NOTE(chogan): 0 for the first SMT sibling of a core, 1 for the second, etc.
+  int sibling;
+};
+
+struct Affinity {
+  AffinityPolicy policy = AffinityPolicy::kNone;
+  std::vector<int> cpus;
+  int num_packages = 0;
+  int num_cores = 0;
+};
+
+static Affinity g_affinity;
+
+static const char *affinity_policy_name(AffinityPolicy policy) {
+  switch (policy) {
+    case AffinityPolicy::kNone:     return "none";
+    case AffinityPolicy::kCompact:  return "compact";
+    case AffinityPolicy::kScatter:  return "scatter";
+    case AffinityPolicy::kPhysical: return "physical";
+    case AffinityPolicy::kList:     return "list";
+  }
+  return "unknown";
+}
+
+// NOTE(chogan): Parses the kernel's cpu list format, e.g. "0-3,8,10-11".
+static bool parse_cpu_list(const char *str, std::vector<int> *result) {
+  const char *p = str;
+  while (*p && *p != '\n') {
+    char *end = 0;
+    long first = strtol(p, &end, 10);
+    if (end == p || first < 0) {
+      return false;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      ++p;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) {
+        return false;
+      }
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      result->push_back((int)cpu);
+    }
+    if (*p == ',') {
+      ++p;
+    } else if (*p && *p != '\n') {
+      return false;
+    }
+  }
+
+  return !result->empty();
+}
+
+static int read_sysfs_int(const char *path, int default_value) {
+  int result = default_value;
+  FILE *file = fopen(path, "r");
+  if (file) {
+    if (fscanf(file, "%d", &result) != 1) {
+      result = default_value;
+    }
+    fclose(file);
+  }
+
+  return result;
+}
+
+static std::vector<CpuInfo> read_cpu_topology() {
+  std::vector<int> online;
+  char buf[4096] = {};
+  FILE *file = fopen("/sys/devices/system/cpu/online", "r");
+  if (file) {
+    if (!fgets(buf, sizeof(buf), file)) {
+      buf[0] = '\0';
+    }
+    fclose(file);
+  }
+  if (!parse_cpu_list(buf, &online)) {
+    // NOTE(chogan): No sysfs (e.g., a container without /sys). Treat every
+    // CPU as its own core on a single socket.
+    online.clear();
+    int num_cpus = (int)std::thread::hardware_concurrency();
+    for (int i = 0; i < std::max(num_cpus, 1); ++i) {
+      online.push_back(i);
+    }
+  }
+
+  std::vector<CpuInfo> result;
+  for (int cpu : online) {
+    char path[256];
+    CpuInfo info = {};
+    info.cpu = cpu;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    info.package = read_sysfs_int(path, 0);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+    info.core = read_sysfs_int(path, cpu);
+    result.push_back(info);
+  }
+
+  // NOTE(chogan): Rank each CPU among the SMT siblings of its core
+  std::sort(result.begin(), result.end(), [](const CpuInfo &a, const CpuInfo &b) {
+    if (a.package != b.package) return a.package < b.package;
+    if (a.core != b.core) return a.core < b.core;
+    return a.cpu < b.cpu;
+  });
+  for (size_t i = 0; i < result.size(); ++i) {
+    bool same_core = (i > 0 && result[i].package == result[i - 1].package &&
+                      result[i].core == result[i - 1].core);
+    result[i].sibling = same_core ? result[i - 1].sibling + 1 : 0;
+  }
+
+  return result;
+}
+
+// NOTE(chogan): Accepts "compact", "scatter", "physical", or an explicit cpu
+// list like "0,2,4-7".
+static bool parse_affinity(const char *arg, Affinity *affinity) {
+  if (strcmp(arg, "none") == 0) {
+    affinity->policy = AffinityPolicy::kNone;
+  } else if (strcmp(arg, "compact") == 0) {
+    affinity->policy = AffinityPolicy::kCompact;
+  } else if (strcmp(arg, "scatter") == 0) {
+    affinity->policy = AffinityPolicy::kScatter;
+  } else if (strcmp(arg, "physical") == 0) {
+    affinity->policy = AffinityPolicy::kPhysical;
+  } else {
+    affinity->policy = AffinityPolicy::kList;
+    affinity->cpus.clear();
+    if (!parse_cpu_list(arg, &affinity->cpus)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// NOTE(chogan): Whether the process may run on `cpu` at all (taskset, cgroup
+// cpusets). The mask is read on the first call, which init_affinity() makes
+// before any thread is pinned, since pinning a thread narrows its own mask.
+static bool cpu_allowed(int cpu) {
+  static const cpu_set_t allowed = [] {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+    return set;
+  }();
+
+  return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed);
+}
+
+static void init_affinity(Affinity *affinity) {
+  std::vector<CpuInfo> topology = read_cpu_topology();
+
+  std::vector<std::pair<int, int>> packages_and_cores;
+  std::vector<int> packages;
+  for (const CpuInfo &info : topology) {
+    packages_and_cores.push_back({info.package, info.core});
+    packages.push_back(info.package);
+  }
+  std::sort(packages_and_cores.begin(), packages_and_cores.end());
+  std::sort(packages.begin(), packages.end());
+  affinity->num_cores = (int)(std::unique(packages_and_cores.begin(), packages_and_cores.end()) -
+                              packages_and_cores.begin());
+  affinity->num_packages = (int)(std::unique(packages.begin(), packages.end()) - packages.begin());
+
+  switch (affinity->policy) {
+    case AffinityPolicy::kNone: {
+      affinity->cpus.clear();
+      break;
+    }
+    case AffinityPolicy::kCompact: {
+      // NOTE(chogan): topology is already sorted by (package, core, cpu)
+      affinity->cpus.clear();
+      for (const CpuInfo &info : topology) {
+        if (cpu_allowed(info.cpu)) {
+          affinity->cpus.push_back(info.cpu);
+        }
+      }
+      break;
+    }
+    case AffinityPolicy::kScatter:
+    case AffinityPolicy::kPhysical: {
+      // NOTE(chogan): Rank each core within its package, then order by
+      // (sibling, core rank, package) so consecutive workers land on different
+      // sockets and every physical core is used before any SMT sibling.
+      std::vector<CpuInfo> sorted = topology;
+      std::vector<int> core_rank(sorted.size());
+      for (size_t i = 0, rank = 0; i < sorted.size(); ++i) {
+        if (i > 0 && sorted[i].package != sorted[i - 1].package) {
+          rank = 0;
+        } else if (i > 0 && sorted[i].core != sorted[i - 1].core) {
+          ++rank;
+        }
+        core_rank[i] = (int)rank;
+      }
+      std::vector<size_t> order(sorted.size());
+      for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+      }
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (sorted[a].sibling != sorted[b].sibling) return sorted[a].sibling < sorted[b].sibling;
+        if (core_rank[a] != core_rank[b]) return core_rank[a] < core_rank[b];
+        return sorted[a].package < sorted[b].package;
+      });
+      // NOTE(chogan): With physical, a core whose first sibling isn't allowed
+      // is still used through the next allowed one
+      affinity->cpus.clear();
+      std::vector<std::pair<int, int>> used_cores;
+      for (size_t i : order) {
+        if (!cpu_allowed(sorted[i].cpu)) {
+          continue;
+        }
+        if (affinity->policy == AffinityPolicy::kPhysical) {
+          std::pair<int, int> core = {sorted[i].package, sorted[i].core};
+          if (std::find(used_cores.begin(), used_cores.end(), core) != used_cores.end()) {
+            continue;
+          }
+          used_cores.push_back(core);
+        }
+        affinity->cpus.push_back(sorted[i].cpu);
+      }
+      break;
+    }
+    case AffinityPolicy::kList: {
+      for (int cpu : affinity->cpus) {
+        bool found = false;
+        for (const CpuInfo &info : topology) {
+          if (info.cpu == cpu) {
+            found = true;
+            break;
+          }
+        }
+        if (!found) {
+          fprintf(stderr, "CPU %d is not online\n", cpu);
+          exit(1);
+        }
+        if (!cpu_allowed(cpu)) {
+          fprintf(stderr, "CPU %d is outside the cpus this process may run on\n", cpu);
+          exit(1);
+        }
+      }
+      break;
+    }
+  }
+
+  if (affinity->policy != AffinityPolicy::kNone && affinity->cpus.empty()) {
+    fprintf(stderr, "None of the cpus this process may run on are in the topology\n");
+    exit(1);
+  }
+}
+
+// NOTE(chogan): Returns the CPU that `worker` is pinned to, or -1 if the
+// policy leaves placement to the scheduler.
+static int affinity_cpu(int worker) {
+  if (g_affinity.cpus.empty()) {
+    return -1;
+  }
+
+  return g_affinity.cpus[worker % g_affinity.cpus.size()];
+}
+
+static void pin_current_thread(int worker) {
+  int cpu = affinity_cpu(worker);
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+      // NOTE(chogan): The run would be labelled with a placement it didn't get
+      fprintf(stderr, "Failed to pin worker %d to CPU %d: %s\n", worker, cpu, strerror(err));
+      exit(1);
+    }
+  }
+}
+
+static void print_affinity(FILE *out) {
+  fprintf(out, "Affinity policy: %s (%d sockets, %d cores, %d cpus)", affinity_policy_name(g_affinity.policy),
+          g_affinity.num_packages, g_affinity.num_cores, (int)read_cpu_topology().size());
+  if (!g_affinity.cpus.empty()) {
+    fprintf(out, ", worker cpus:");
+    for (int cpu : g_affinity.cpus) {
+      fprintf(out, " %d", cpu);
+    }
+  }
+  fprintf(out, "\n");
+}
+
+#endif  // MTH5_AFFINITY_H_
@@ -0,0 +1,112 @@
+#ifndef MTH5_COPY_H_
+#define MTH5_COPY_H_
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "phase.h"
+#include "trace.h"
+
+// NOTE(chogan): Raw file copies are split into pieces of this many bytes, which
+// workers take round robin
+const uint64_t kCopyExtentBytes = 64 * 1024 * 1024;
+
+// NOTE(chogan): Copies `bytes` bytes from `src_offset` in `src_fd` to
+// `dst_offset` in `dst_fd` with copy_file_range, which lets the kernel (or
+// the file system, with reflinks or server side copies) move the data without
+// a round trip through user space. If the kernel or file system can't do that
+// for these files the rest goes through `fallback` with pread and pwrite.
+// Returns false if the fallback was used.
+static bool copy_extent(int src_fd, uint64_t src_offset, int dst_fd, uint64_t dst_offset,
+                        uint64_t bytes, std::vector<char> *fallback) {
+  bool result = true;
+  while (bytes > 0 && result) {
+    loff_t in = (loff_t)src_offset;
+    loff_t out = (loff_t)dst_offset;
+    ssize_t copied = TRACE_CALL("copy_file_range", copy_file_range(src_fd, &in, dst_fd, &out,
+                                                                   bytes, 0));
+    if (copied < 0) {
+      assert((errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL) &&
+             "copy_file_range failed");
+      result = false;
+      break;
+    }
+    assert(copied > 0 && "Source ended before the extent");
+    src_offset += copied;
+    dst_offset += copied;
+    bytes -= copied;
+  }
+
+  if (bytes > 0) {
+    fallback->resize(std::min(bytes, kCopyExtentBytes));
+  }
+  while (bytes > 0) {
+    size_t size = std::min(bytes, (uint64_t)fallback->size());
+    assert(TRACE_CALL("pread", pread(src_fd, fallback->data(), size, src_offset)) ==
+           (ssize_t)size);
+    assert(TRACE_CALL("pwrite", pwrite(dst_fd, fallback->data(), size, dst_offset)) ==
+           (ssize_t)size);
+    src_offset += size;
+    dst_offset += size;
+    bytes -= size;
+  }
+
+  return result;
+}
+
+// NOTE(chogan): A byte range at the same offset in the source and destination
+struct FileExtent {
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+// NOTE(chogan): Splits `extents` into pieces of at most kCopyExtentBytes bytes
+static std::vector<FileExtent> split_file_extents(const std::vector<FileExtent> &extents) {
+  std::vector<FileExtent> result;
+  for (const FileExtent &extent : extents) {
+    for (uint64_t offset = 0; offset < extent.bytes; offset += kCopyExtentBytes) {
+      result.push_back({extent.offset + offset, std::min(kCopyExtentBytes, extent.bytes - offset)});
+    }
+  }
+
+  return result;
+}
+
+// NOTE(chogan): Copies `pieces` (from split_file_extents()) of `src_fd` to the
+// same offsets in `dst_fd` with `phase`'s workers, each taking every
+// num_threads'th piece. This is the ceiling for copying the same bytes
+// through the library. Returns false if any piece fell back to pread and
+// pwrite.
+static bool copy_file_extents(Phase *phase, int src_fd, int dst_fd,
+                              const std::vector<FileExtent> &pieces) {
+  std::atomic<bool> result(true);
+
+  auto copy_func = [src_fd, dst_fd, &pieces, phase, &result](int worker) {
+    std::vector<char> fallback;
+    for (size_t piece = worker; piece < pieces.size(); piece += phase->num_threads) {
+      const FileExtent &extent = pieces[piece];
+      if (!copy_extent(src_fd, extent.offset, dst_fd, extent.offset, extent.bytes, &fallback)) {
+        result = false;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  start_phase(phase);
+  for (int i = 0; i < phase->num_threads; ++i) {
+    threads.push_back(spawn_worker(phase, i, copy_func, i));
+  }
+  join_workers(threads);
+  end_phase(phase);
+
+  return result;
+}
+
+#endif  // MTH5_COPY_H_
@@ -1,7 +1,26 @@
 import argparse
+import struct
+
 import h5py
 import numpy as np
 
+# Must match kVerifyBlockBytes in verify.h
+VERIFY_BLOCK_BYTES = 1024 * 1024
+
+
+def xxh64_digest(arr):
+    """XXH64 of each 1 MiB block, then XXH64 of the little endian block digests.
+
+    This is the digest verify.h computes in parallel for `mth5 -H`.
+    """
+    import xxhash
+    data = arr.astype('<i8').tobytes()
+    block_digests = b''.join(
+        struct.pack('<Q', xxhash.xxh64_intdigest(data[i:i + VERIFY_BLOCK_BYTES]))
+        for i in range(0, len(data), VERIFY_BLOCK_BYTES))
+    return len(data), xxhash.xxh64_intdigest(block_digests)
+
+
 def main(args):
     file_params = {'name': args.file, 'mode': 'w'}
     if (args.F):
@@ -13,6 +32,12 @@ def main(args):
 
     dset_names = ['a', 'b', 'c', 'd', 'e', 'f', 'g', 'h']
 
+    if (args.m):
+        num_bytes, digest = xxh64_digest(arr)
+        with open(args.file + '.xxh64', 'w') as manifest:
+            for name in dset_names:
+                manifest.write('{} {} {:016x}\n'.format(name, num_bytes, digest))
+
     for name in dset_names:
         dset_params = {'name': name, 'shape': (dset_size,), 'dtype': 'i8', 'data': arr}
 
@@ -28,6 +53,8 @@ if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Create a test file for H5Dread() profiling.')
     parser.add_argument('-c', action='store_true', help='Create a chunked dataset.')
     parser.add_argument('-F', action='store_true', help='Use the latest file format')
+    parser.add_argument('-m', action='store_true',
+                        help="Write an XXH64 manifest to 'file.xxh64' (needs the xxhash module)")
     parser.add_argument('file', help='The name of the file.')
     args = parser.parse_args()
     main(args)
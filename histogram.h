@@ -0,0 +1,101 @@
+#ifndef MTH5_HISTOGRAM_H_
+#define MTH5_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// NOTE(chogan): Fixed size log-linear latency histogram. Every power of 2 is
+// split into kHistogramSubBuckets linear buckets, so percentiles are within
+// 1/kHistogramSubBuckets (12.5%) of the true value. It is plain data so it can
+// live in shared memory and be merged across threads and processes.
+const int kHistogramSubBucketBits = 3;
+const int kHistogramSubBuckets = 1 << kHistogramSubBucketBits;
+const int kHistogramBuckets = 64 * kHistogramSubBuckets;
+
+struct LatencyHistogram {
+  uint64_t counts[kHistogramBuckets];
+  uint64_t total;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  double sum_ns;
+};
+
+static void init_histogram(LatencyHistogram *histogram) {
+  memset(histogram, 0, sizeof(*histogram));
+  histogram->min_ns = UINT64_MAX;
+}
+
+static int histogram_bucket(uint64_t ns) {
+  if (ns < kHistogramSubBuckets) {
+    return (int)ns;
+  }
+  int log2 = 63 - __builtin_clzll(ns);
+  int sub_bucket = (int)((ns >> (log2 - kHistogramSubBucketBits)) & (kHistogramSubBuckets - 1));
+
+  return (log2 - kHistogramSubBucketBits + 1) * kHistogramSubBuckets + sub_bucket;
+}
+
+// NOTE(chogan): The smallest value that maps to `bucket`
+static uint64_t histogram_bucket_value(int bucket) {
+  if (bucket < kHistogramSubBuckets) {
+    return (uint64_t)bucket;
+  }
+  int log2 = bucket / kHistogramSubBuckets + kHistogramSubBucketBits - 1;
+  uint64_t sub_bucket = (uint64_t)(bucket % kHistogramSubBuckets);
+
+  return (1ULL << log2) | (sub_bucket << (log2 - kHistogramSubBucketBits));
+}
+
+static void record_latency(LatencyHistogram *histogram, uint64_t ns) {
+  histogram->counts[histogram_bucket(ns)]++;
+  histogram->total++;
+  histogram->sum_ns += (double)ns;
+  if (ns < histogram->min_ns) {
+    histogram->min_ns = ns;
+  }
+  if (ns > histogram->max_ns) {
+    histogram->max_ns = ns;
+  }
+}
+
+static void merge_histogram(LatencyHistogram *total, const LatencyHistogram &histogram) {
+  for (int i = 0; i < kHistogramBuckets; ++i) {
+    total->counts[i] += histogram.counts[i];
+  }
+  total->total += histogram.total;
+  total->sum_ns += histogram.sum_ns;
+  if (histogram.min_ns < total->min_ns) {
+    total->min_ns = histogram.min_ns;
+  }
+  if (histogram.max_ns > total->max_ns) {
+    total->max_ns = histogram.max_ns;
+  }
+}
+
+// NOTE(chogan): `percentile` is in [0, 100]. Returns nanoseconds.
+static double histogram_percentile(const LatencyHistogram &histogram, double percentile) {
+  if (histogram.total == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(percentile / 100.0 * (double)(histogram.total - 1)) + 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < kHistogramBuckets; ++i) {
+    seen += histogram.counts[i];
+    if (seen >= rank) {
+      uint64_t value = histogram_bucket_value(i);
+      // NOTE(chogan): Clamp to the observed range so p0 and p100 are exact
+      if (value < histogram.min_ns) value = histogram.min_ns;
+      if (value > histogram.max_ns) value = histogram.max_ns;
+      return (double)value;
+    }
+  }
+
+  return (double)histogram.max_ns;
+}
+
+static double histogram_mean(const LatencyHistogram &histogram) {
+  return histogram.total ? histogram.sum_ns / (double)histogram.total : 0;
+}
+
+#endif  // MTH5_HISTOGRAM_H_
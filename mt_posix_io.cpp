@@ -1,12 +1,20 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include <chrono>
 #include <thread>
 #include <vector>
 
+#include "affinity.h"
+#include "copy.h"
+#include "phase.h"
+#include "trace.h"
+#include "verify.h"
+
 typedef uint32_t u32;
 typedef uint64_t u64;
 
@@ -15,7 +23,7 @@ const int max_threads = 8;
 const int max_dsets = 8;
 const int dset_size = 64 * 1024 * 1024;
 
-void create_file(const char *fname, int num_dsets) {
+void create_file(const char *fname, const char **dset_names, int num_dsets, bool use_manifest) {
   FILE *file = fopen(fname, "w");
   assert(file);
 
@@ -28,15 +36,9 @@ void create_file(const char *fname, int num_dsets) {
     assert(fwrite(data.data(), dset_size * sizeof(u64), 1, file) == 1);
   }
   assert(fclose(file) == 0);
-}
 
-void verify_datasets(int num_dsets, int dset_size, u64 **destinations) {
-  for (int i = 0; i < num_dsets; ++i) {
-    u64 counter = 0;
-    u64 *current_dset = destinations[i];
-    for (int j = 0; j < dset_size; ++j) {
-      assert(current_dset[j] == counter++);
-    }
+  if (use_manifest) {
+    write_uniform_manifest(fname, dset_names, num_dsets, data.data(), dset_size * sizeof(u64));
   }
 }
 
@@ -52,39 +54,80 @@ void write_datasets(const char *file_name, int num_dsets, int num_threads, bool
   assert(file);
 
   auto write_func = [&data, dset_bytes](int fd, off_t offset) {
-    assert(pwrite(fd, data.data(), dset_bytes, offset) == (int)dset_bytes);
+    assert(TRACE_CALL("pwrite", pwrite(fd, data.data(), dset_bytes, offset)) == (int)dset_bytes);
     fprintf(stderr, "Wrote %d of %zu elements\n", dset_size, (size_t)dset_size);
   };
 
+  Phase phase("write", do_on_worker, num_threads, do_on_worker ? num_threads : num_dsets,
+              (uint64_t)num_dsets * dset_bytes);
+
   if (do_on_worker) {
     std::vector<std::thread> threads;
 
+    start_phase(&phase);
     for (int i = 0; i < num_threads; ++i) {
       off_t offset = i * dset_bytes;
-      threads.push_back(std::thread(write_func, fileno(file), offset));
-    }
-    for (int i = 0; i < num_threads; ++i) {
-      threads[i].join();
+      threads.push_back(spawn_worker(&phase, i, write_func, fileno(file), offset));
     }
+    join_workers(threads);
+    end_phase(&phase);
   } else {
     FILE *file = fopen(file_name, "w");
     assert(file);
+    start_phase(&phase);
     for (int i = 0; i < num_dsets; ++i) {
       off_t offset = i * dset_bytes;
       write_func(fileno(file), offset);
     }
+    end_phase(&phase);
   }
   assert(fclose(file) == 0);
+
+  fprintf(stderr, "Total seconds to write %d datasets with %d threads: %f\n", num_dsets,
+          phase.num_threads, phase.seconds);
+  report_phase_counters(stderr, &phase);
+}
+
+// NOTE(chogan): The ceiling for mth5's --copy: the same bytes copied with
+// copy_file_range from num_threads threads, with no library in the way
+void copy_datasets(const char *in_file_name, const char *out_file_name, int num_dsets,
+                   int num_threads) {
+  const uint64_t total_bytes = (uint64_t)num_dsets * dset_size * sizeof(u64);
+  int src_fd = open(in_file_name, O_RDONLY);
+  assert(src_fd >= 0);
+  int dst_fd = open(out_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(dst_fd >= 0);
+  assert(ftruncate(dst_fd, total_bytes) == 0);
+
+  std::vector<FileExtent> pieces = split_file_extents({{0, total_bytes}});
+  Phase phase("copy", true, num_threads, pieces.size(), total_bytes);
+  bool used_copy_file_range = copy_file_extents(&phase, src_fd, dst_fd, pieces);
+  assert(close(dst_fd) == 0);
+  assert(close(src_fd) == 0);
+
+  fprintf(stderr, "Total seconds to copy %d datasets with %d threads: %f (%f GB/s%s)\n",
+          num_dsets, num_threads, phase.seconds,
+          total_bytes / phase.seconds / (1024.0 * 1024.0 * 1024.0),
+          used_copy_file_range ? "" : ", fell back to pread and pwrite");
+  report_phase_counters(stderr, &phase);
 }
 
 void show_usage_and_exit(const char *prog) {
-  fprintf(stderr, "Usage: %s -c file_name\n", prog);
-  fprintf(stderr, "       %s -f file_name [-t num_threads] [-d num_dsets] [-rs]\n", prog);
-  fprintf(stderr, "       %s -w file_name [-t num_threads] [-d num_dsets] [-as]\n", prog);
+  fprintf(stderr, "Usage: %s -c file_name [-d num_dsets] [-H]\n", prog);
+  fprintf(stderr, "       %s -f file_name [-t num_threads] [-d num_dsets] [-p policy] [-T trace_file] [-eHrs]\n", prog);
+  fprintf(stderr, "       %s -f file_name -C out_file [-t num_threads] [-d num_dsets] [-p policy] [-T trace_file] [-es]\n", prog);
+  fprintf(stderr, "       %s -w file_name [-t num_threads] [-d num_dsets] [-p policy] [-T trace_file] [-aes]\n", prog);
   fprintf(stderr, "    -a: Do writes on worker threads\n");
   fprintf(stderr, "    -c: Create a test file called 'file_name'\n");
+  fprintf(stderr, "    -C: Copy 'file_name' to 'out_file' with copy_file_range from num_threads\n");
+  fprintf(stderr, "        threads, the ceiling for mth5 --copy\n");
+  fprintf(stderr, "    -e: Collect perf_event counters for each phase\n");
+  fprintf(stderr, "    -H: Verify reads against the XXH64 manifest 'file_name.xxh64'. With -c, write\n");
+  fprintf(stderr, "        the manifest too\n");
+  fprintf(stderr, "    -p: Pin threads with policy 'compact', 'scatter', 'physical', or a cpu list\n");
   fprintf(stderr, "    -r: Read datasets in the worker threads\n");
   fprintf(stderr, "    -s: Skip verification of results\n");
+  fprintf(stderr, "    -T: Write a Chrome trace of every thread's calls to 'trace_file'\n");
   exit(1);
 }
 
@@ -99,13 +142,16 @@ int main (int argc, char* argv[]) {
   int num_dsets = 8;
   char *in_file_name = 0;
   char *out_file_name = 0;
+  char *trace_file_name = 0;
   bool create_test_file = false;
   bool verify_results = true;
   bool do_write = false;
+  bool do_copy = false;
   bool read_on_workers = false;
   bool write_on_workers = false;
+  bool use_manifest = false;
 
-  while ((option = getopt(argc, argv, "ac:d:f:rst:w:")) != -1) {
+  while ((option = getopt(argc, argv, "ac:C:d:ef:Hp:rsT:t:w:")) != -1) {
     switch (option) {
       case 'a': {
         write_on_workers = true;
@@ -116,14 +162,34 @@ int main (int argc, char* argv[]) {
         out_file_name = optarg;
         break;
       }
+      case 'C': {
+        do_copy = true;
+        out_file_name = optarg;
+        break;
+      }
       case 'd': {
         num_dsets = atoi(optarg);
         break;
       }
+      case 'e': {
+        g_perf_enabled = true;
+        break;
+      }
       case 'f': {
         in_file_name = optarg;
         break;
       }
+      case 'H': {
+        use_manifest = true;
+        break;
+      }
+      case 'p': {
+        if (!parse_affinity(optarg, &g_affinity)) {
+          fprintf(stderr, "Invalid affinity policy '%s'.\n", optarg);
+          show_usage_and_exit(argv[0]);
+        }
+        break;
+      }
       case 'r': {
         read_on_workers = true;
         break;
@@ -132,6 +198,11 @@ int main (int argc, char* argv[]) {
         verify_results = false;
         break;
       }
+      case 'T': {
+        trace_file_name = optarg;
+        g_trace_enabled = true;
+        break;
+      }
       case 't': {
         num_threads = atoi(optarg);
         assert(num_threads <= max_dsets);
@@ -152,12 +223,18 @@ int main (int argc, char* argv[]) {
     show_usage_and_exit(argv[0]);
   }
 
-  assert(do_write || create_test_file ? out_file_name : in_file_name);
+  assert(do_write || create_test_file || do_copy ? out_file_name : in_file_name);
+  assert(!do_copy || in_file_name);
   assert((num_threads == num_dsets || num_threads == 1 || num_dsets == 1) && "Invalid configuration");
   if (num_dsets == 1) {
     assert(dset_size % num_threads == 0);
   }
 
+  init_affinity(&g_affinity);
+  print_affinity(stderr);
+  pin_current_thread(0);
+  set_trace_thread_name("main");
+
   u64 *a = (u64 *)malloc(dset_size * sizeof(u64));
   u64 *b = (u64 *)malloc(dset_size * sizeof(u64));
   u64 *c = (u64 *)malloc(dset_size * sizeof(u64));
@@ -167,14 +244,19 @@ int main (int argc, char* argv[]) {
   u64 *g = (u64 *)malloc(dset_size * sizeof(u64));
   u64 *h = (u64 *)malloc(dset_size * sizeof(u64));
 
+  const char *dset_names[] = {"a", "b", "c", "d", "e", "f", "g", "h"};
   u64 *destinations[] = {a, b, c, d, e, f, g, h};
   const int num_ids = num_threads == 1 ? num_dsets : num_threads;
   std::vector<FILE *> dset_ids(num_ids);
 
   if (create_test_file) {
-    create_file(out_file_name, num_dsets);
+    create_file(out_file_name, dset_names, num_dsets, use_manifest);
+    // NOTE(chogan): Nothing was read, so there is nothing to verify
+    verify_results = false;
   } else if (do_write) {
     write_datasets(out_file_name, num_dsets, num_threads, write_on_workers);
+  } else if (do_copy) {
+    copy_datasets(in_file_name, out_file_name, num_dsets, num_threads);
   } else {
     for (int i = 0; i < num_ids; ++i) {
       FILE *fid = fopen(in_file_name, "r");
@@ -184,27 +266,36 @@ int main (int argc, char* argv[]) {
 
     auto read_func = [&dset_ids, &destinations](int dset_index, off_t offset) {
       size_t total_size = dset_size * sizeof(u64);
-      assert(pread(fileno(dset_ids[dset_index]), destinations[dset_index], total_size,
-                   offset) == (int)total_size);
+      assert(TRACE_CALL("pread", pread(fileno(dset_ids[dset_index]), destinations[dset_index],
+                                       total_size, offset)) == (int)total_size);
       fprintf(stderr, "Read chunk %d of size %d\n", dset_index, dset_size);
     };
 
+    Phase phase("read", read_on_workers, num_threads, read_on_workers ? num_threads : num_dsets,
+                (uint64_t)num_dsets * dset_size * sizeof(u64));
+
     if (read_on_workers) {
       std::vector<std::thread> threads;
+      start_phase(&phase);
       for (int i = 0; i < num_threads; ++i) {
         off_t offset = i * dset_size * sizeof(u64);
-        threads.push_back(std::thread(read_func, i, offset));
+        threads.push_back(spawn_worker(&phase, i, read_func, i, offset));
       }
 
-      for (int i = 0; i < num_threads; ++i) {
-        threads[i].join();
-      }
+      join_workers(threads);
+      end_phase(&phase);
     } else {
+      start_phase(&phase);
       for (int i = 0; i < num_dsets; ++i) {
         read_func(i, i * dset_size * sizeof(u64));
       }
+      end_phase(&phase);
     }
 
+    fprintf(stderr, "Total seconds to read %d datasets with %d threads: %f\n", num_dsets,
+            phase.num_threads, phase.seconds);
+    report_phase_counters(stderr, &phase);
+
     for (int i = 0; i < num_ids; ++i) {
       assert(fclose(dset_ids[i]) == 0);
     }
@@ -235,9 +326,13 @@ int main (int argc, char* argv[]) {
 
   }
 
+  if (trace_file_name) {
+    write_trace(trace_file_name);
+  }
+
   if (verify_results) {
     fprintf(stderr, "Verifying results\n");
-    if (do_write) {
+    if (do_write || do_copy) {
       FILE *out_file_id = fopen(out_file_name, "r");
       assert(out_file_id);
 
@@ -248,10 +343,13 @@ int main (int argc, char* argv[]) {
       }
       assert(fclose(out_file_id) == 0);
 
-      verify_datasets(num_dsets, dset_size, destinations);
+      assert(verify_datasets(num_dsets, dset_size, destinations) && "Verification failed");
       assert(remove(out_file_name) == 0);
+    } else if (use_manifest) {
+      assert(verify_datasets_against_manifest(in_file_name, dset_names, num_dsets, dset_size,
+                                              destinations) && "Verification failed");
     } else {
-      verify_datasets(num_dsets, dset_size, destinations);
+      assert(verify_datasets(num_dsets, dset_size, destinations) && "Verification failed");
     }
     fprintf(stderr, "Success.\n");
   }
@@ -1,17 +1,39 @@
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include "hdf5.h"
 #include "ittnotify.h"
 
-extern int H5S_init_g;
-herr_t H5S__init_package();
+#include "affinity.h"
+#include "copy.h"
+#include "histogram.h"
+#include "phase.h"
+#include "results.h"
+#include "trace.h"
+#include "verify.h"
+#include "vfd.h"
 
 typedef uint32_t u32;
 typedef uint64_t u64;
@@ -21,84 +43,361 @@ const int max_threads = 8;
 const int max_dsets = 8;
 const int dset_size = 64 * 1024 * 1024;
 
+// NOTE(chogan): Read settings chosen by --autotune and loaded with --tuned.
+// 0 keeps the library default (one H5Dread per thread, the default sieve
+// buffer, no page buffer).
+static hsize_t g_request_elems = 0;
+static size_t g_sieve_bytes = 0;
+static size_t g_page_buffer_bytes = 0;
+
+// NOTE(chogan): HDF5 initializes each package (H5S, H5T, H5D, H5P, H5CX, ...)
+// lazily on first use. Letting that happen inside the first timed phase both
+// charges it with startup cost and races the initialization across worker
+// threads. A throwaway create/write/open/read/close on an in-memory (core
+// driver, no backing store) file goes through the same paths as the timed
+// phases, so everything they need is initialized before any worker starts.
+const hsize_t kWarmUpElems = 1024;
+// NOTE(chogan): H5Fcreate, H5Dcreate, H5Dwrite, H5Dclose, H5Dopen, 2 H5Dread,
+// H5Dclose, and H5Fclose in warm_up_pass()
+const int kWarmUpCalls = 9;
+
+static void warm_up_pass() {
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  assert(fapl >= 0);
+  assert(H5Pset_fapl_core(fapl, kWarmUpElems * sizeof(u64), 0) >= 0);
+  hid_t file_id = H5Fcreate("mth5-warm-up.h5", H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+  assert(file_id >= 0);
+
+  u64 data[kWarmUpElems];
+  for (hsize_t i = 0; i < kWarmUpElems; ++i) {
+    data[i] = i;
+  }
+  hid_t dspace = H5Screate_simple(1, &kWarmUpElems, NULL);
+  assert(dspace >= 0);
+  hid_t dset_id = H5Dcreate(file_id, "a", H5T_NATIVE_ULONG, dspace, H5P_DEFAULT, H5P_DEFAULT,
+                            H5P_DEFAULT);
+  assert(dset_id >= 0);
+  assert(H5Dwrite(dset_id, H5T_NATIVE_ULONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0);
+  assert(H5Dclose(dset_id) >= 0);
+
+  // NOTE(chogan): Both the H5S_ALL and the hyperslab read paths are used by
+  // the timed phases. Like them, this reads the H5T_NATIVE_ULONG dataset as
+  // H5T_STD_I64LE, so that conversion path is set up here rather than in the
+  // first timed H5Dread.
+  dset_id = H5Dopen(file_id, "a", H5P_DEFAULT);
+  assert(dset_id >= 0);
+  assert(H5Dread(dset_id, H5T_STD_I64LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0);
+  const hsize_t offset = kWarmUpElems / 2;
+  const hsize_t count = kWarmUpElems / 2;
+  hid_t mspace = H5Screate_simple(1, &count, NULL);
+  assert(mspace >= 0);
+  assert(H5Sselect_hyperslab(dspace, H5S_SELECT_SET, &offset, NULL, &count, NULL) >= 0);
+  assert(H5Dread(dset_id, H5T_STD_I64LE, mspace, dspace, H5P_DEFAULT, data) >= 0);
+  assert(data[0] == offset);
+
+  assert(H5Sclose(mspace) >= 0);
+  assert(H5Dclose(dset_id) >= 0);
+  assert(H5Sclose(dspace) >= 0);
+  assert(H5Fclose(file_id) >= 0);
+  assert(H5Pclose(fapl) >= 0);
+}
+
+// NOTE(chogan): Runs the warm up twice. The first pass is the cold start cost a
+// short lived job pays once; the second is the same work in steady state.
+static void warm_up_library(bool report) {
+  const uint64_t bytes = 3 * kWarmUpElems * sizeof(u64) / 2 + kWarmUpElems * sizeof(u64);
+  Phase cold("cold start", false, 1, kWarmUpCalls, bytes, false);
+  start_phase(&cold);
+  warm_up_pass();
+  end_phase(&cold);
+
+  Phase steady("steady state", false, 1, kWarmUpCalls, bytes, false);
+  start_phase(&steady);
+  warm_up_pass();
+  end_phase(&steady);
+
+  if (report) {
+    fprintf(stderr, "Library warm up: cold start %f seconds, steady state %f seconds "
+            "(%f seconds of one time initialization)\n", cold.seconds, steady.seconds,
+            cold.seconds - steady.seconds);
+    report_phase_counters(stderr, &cold);
+    report_phase_counters(stderr, &steady);
+  }
+}
+
 void open_datasets(hid_t file_id, std::vector<hid_t> &dset_ids, const char **dset_names,
                    int num_dsets, int num_threads, bool do_on_worker) {
   std::vector<std::thread> threads;
 
   auto open_func = [file_id, dset_names, &dset_ids](int name_index, int id_index) {
-    hid_t id = H5Dopen(file_id, dset_names[name_index], H5P_DEFAULT);
+    hid_t id = TRACE_CALL("H5Dopen", H5Dopen(file_id, dset_names[name_index], H5P_DEFAULT));
     assert(id >= 0);
     dset_ids[id_index] = id;
     fprintf(stderr, "Opened %s\n", dset_names[name_index]);
   };
 
-  auto start = now();
-  auto end = now();
+  Phase phase("open", do_on_worker, num_threads, do_on_worker ? num_threads : num_dsets, 0);
 
   if (do_on_worker) {
     if (num_threads != (int)num_dsets) {
       assert(num_dsets == 1);
     }
-    start = now();
+    start_phase(&phase);
     for (int i = 0; i < num_threads; ++i) {
       // NOTE(chogan): If we only have 1 dataset, then we open the first name,
       // otherwise we open the ith name
       int name_index = num_dsets == 1 ? 0 : i;
-      threads.push_back(std::thread(open_func, name_index, i));
+      threads.push_back(spawn_worker(&phase, i, open_func, name_index, i));
     }
 
-    for (int i = 0; i < num_threads; ++i) {
-      threads[i].join();
-    }
-    end = now();
+    join_workers(threads);
+    end_phase(&phase);
   } else {
-    start = now();
+    start_phase(&phase);
     for (int i = 0; i < num_dsets; ++i) {
       open_func(i, i);
     }
-    end = now();
+    end_phase(&phase);
   }
-  double total_seconds = std::chrono::duration<double>(end - start).count();
   fprintf(stderr, "Total seconds to open %d datasets with %d threads: %f\n", num_dsets,
-          do_on_worker ? num_threads : 1, total_seconds);
+          phase.num_threads, phase.seconds);
+  report_phase_counters(stderr, &phase);
+}
+
+// NOTE(chogan): File space and fill settings for files and datasets the
+// harness writes (-w, --pipeline, --alloc-sweep). The defaults leave every
+// property at the library default.
+struct AllocOptions {
+  H5D_alloc_time_t alloc_time;
+  bool set_fill_time;
+  H5D_fill_time_t fill_time;
+  bool set_strategy;
+  H5F_fspace_strategy_t strategy;
+  hsize_t page_size;
+  // NOTE(chogan): 0 writes contiguous datasets
+  hsize_t chunk_elems;
+  bool preallocate;
+};
+
+static AllocOptions g_alloc_options = {H5D_ALLOC_TIME_DEFAULT, false, H5D_FILL_TIME_IFSET, false,
+                                       H5F_FSPACE_STRATEGY_FSM_AGGR, 0, 0, false};
+
+// NOTE(chogan): Preallocation extends the file in steps of this many bytes,
+// aligned to the step size
+const uint64_t kPreallocateStepBytes = 64 * 1024 * 1024;
+
+static bool parse_alloc_time(const char *arg, H5D_alloc_time_t *result) {
+  if (strcmp(arg, "early") == 0) {
+    *result = H5D_ALLOC_TIME_EARLY;
+  } else if (strcmp(arg, "incr") == 0) {
+    *result = H5D_ALLOC_TIME_INCR;
+  } else if (strcmp(arg, "late") == 0) {
+    *result = H5D_ALLOC_TIME_LATE;
+  } else if (strcmp(arg, "default") == 0) {
+    *result = H5D_ALLOC_TIME_DEFAULT;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+static bool parse_fill_time(const char *arg, H5D_fill_time_t *result) {
+  if (strcmp(arg, "alloc") == 0) {
+    *result = H5D_FILL_TIME_ALLOC;
+  } else if (strcmp(arg, "never") == 0) {
+    *result = H5D_FILL_TIME_NEVER;
+  } else if (strcmp(arg, "ifset") == 0) {
+    *result = H5D_FILL_TIME_IFSET;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+static bool parse_fspace_strategy(const char *arg, H5F_fspace_strategy_t *result) {
+  if (strcmp(arg, "fsm") == 0) {
+    *result = H5F_FSPACE_STRATEGY_FSM_AGGR;
+  } else if (strcmp(arg, "page") == 0) {
+    *result = H5F_FSPACE_STRATEGY_PAGE;
+  } else if (strcmp(arg, "aggr") == 0) {
+    *result = H5F_FSPACE_STRATEGY_AGGR;
+  } else if (strcmp(arg, "none") == 0) {
+    *result = H5F_FSPACE_STRATEGY_NONE;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+static hid_t create_write_fcpl() {
+  hid_t result = H5Pcreate(H5P_FILE_CREATE);
+  assert(result >= 0);
+  if (g_alloc_options.set_strategy) {
+    assert(H5Pset_file_space_strategy(result, g_alloc_options.strategy, 0, 1) >= 0);
+  }
+  if (g_alloc_options.page_size) {
+    assert(H5Pset_file_space_page_size(result, g_alloc_options.page_size) >= 0);
+  }
+
+  return result;
+}
+
+static hid_t create_write_dcpl(hsize_t dset_elems) {
+  hid_t result = H5Pcreate(H5P_DATASET_CREATE);
+  assert(result >= 0);
+  if (g_alloc_options.chunk_elems) {
+    const hsize_t chunk_elems = std::min(g_alloc_options.chunk_elems, dset_elems);
+    assert(H5Pset_chunk(result, 1, &chunk_elems) >= 0);
+  }
+  if (g_alloc_options.alloc_time != H5D_ALLOC_TIME_DEFAULT) {
+    assert(H5Pset_alloc_time(result, g_alloc_options.alloc_time) >= 0);
+  }
+  if (g_alloc_options.set_fill_time) {
+    assert(H5Pset_fill_time(result, g_alloc_options.fill_time) >= 0);
+  }
+
+  return result;
+}
+
+static hid_t create_write_file(const char *file_name) {
+  hid_t fcpl = create_write_fcpl();
+  hid_t result = TRACE_CALL("H5Fcreate", H5Fcreate(file_name, H5F_ACC_TRUNC, fcpl, H5P_DEFAULT));
+  assert(result >= 0);
+  assert(H5Pclose(fcpl) >= 0);
+
+  return result;
+}
+
+// NOTE(chogan): Reserves file system blocks for the raw data of `dset_ids`
+// (`dset_bytes` each) with fallocate from `num_threads` threads before the
+// writers start, so block allocation isn't done by the writers.
+// FALLOC_FL_KEEP_SIZE leaves the file size (and so the library's view of the
+// EOF) alone. Datasets allocated early report their extents with
+// H5Dget_offset. The rest (late or incremental allocation, or chunked) don't
+// have extents yet, so the range past the current end of the file, where the
+// library will allocate them, is reserved instead.
+static void preallocate_file(hid_t file_id, const std::vector<hid_t> &dset_ids,
+                             uint64_t dset_bytes, int num_threads) {
+  int *fd = 0;
+  assert(H5Fget_vfd_handle(file_id, H5P_DEFAULT, (void **)&fd) >= 0);
+  hsize_t file_size = 0;
+  assert(H5Fget_filesize(file_id, &file_size) >= 0);
+
+  uint64_t start = UINT64_MAX;
+  uint64_t end = 0;
+  uint64_t unallocated = 0;
+  for (hid_t dset_id : dset_ids) {
+    haddr_t offset = H5Dget_offset(dset_id);
+    if (offset == HADDR_UNDEF) {
+      ++unallocated;
+    } else {
+      start = std::min(start, (uint64_t)offset);
+      end = std::max(end, (uint64_t)offset + dset_bytes);
+    }
+  }
+  if (unallocated) {
+    start = std::min(start, (uint64_t)file_size);
+    end = std::max(end, (uint64_t)file_size + unallocated * dset_bytes);
+  }
+  const uint64_t first_step = start / kPreallocateStepBytes;
+  const uint64_t num_steps = (end + kPreallocateStepBytes - 1) / kPreallocateStepBytes - first_step;
+  std::atomic<bool> supported(true);
+
+  auto preallocate_func = [fd, first_step, num_steps, num_threads, &supported](int worker) {
+    for (uint64_t step = worker; step < num_steps && supported; step += num_threads) {
+      int err = TRACE_CALL("fallocate", fallocate(*fd, FALLOC_FL_KEEP_SIZE,
+                                                  (first_step + step) * kPreallocateStepBytes,
+                                                  kPreallocateStepBytes));
+      if (err != 0) {
+        assert(errno == EOPNOTSUPP && "fallocate failed");
+        supported = false;
+      }
+    }
+  };
+
+  Phase phase("preallocate", true, num_threads, num_steps, num_steps * kPreallocateStepBytes,
+              false);
+  std::vector<std::thread> threads;
+  start_phase(&phase);
+  for (int i = 0; i < num_threads; ++i) {
+    threads.push_back(spawn_worker(&phase, i, preallocate_func, i));
+  }
+  join_workers(threads);
+  end_phase(&phase);
+
+  if (supported) {
+    fprintf(stderr, "Total seconds to preallocate %llu bytes with %d threads: %f\n",
+            (unsigned long long)(num_steps * kPreallocateStepBytes), num_threads, phase.seconds);
+    report_phase_counters(stderr, &phase);
+  } else {
+    fprintf(stderr, "The file system doesn't support fallocate, skipping preallocation\n");
+  }
+}
+
+// NOTE(chogan): Dataset close and file flush/close write out everything the
+// library buffered during the write phase, so they get their own phase rather
+// than being mixed into the write time.
+static void flush_and_close(hid_t file_id, const std::vector<hid_t> &dset_ids) {
+  Phase phase("flush and close", false, 1, dset_ids.size() + 2, 0);
+  start_phase(&phase);
+  for (hid_t dset_id : dset_ids) {
+    assert(TRACE_CALL("H5Dclose", H5Dclose(dset_id)) >= 0);
+  }
+  assert(TRACE_CALL("H5Fflush", H5Fflush(file_id, H5F_SCOPE_LOCAL)) >= 0);
+  assert(TRACE_CALL("H5Fclose", H5Fclose(file_id)) >= 0);
+  end_phase(&phase);
+
+  fprintf(stderr, "Total seconds to flush and close %zu datasets: %f\n", dset_ids.size(),
+          phase.seconds);
+  report_phase_counters(stderr, &phase);
 }
 
 void write_datasets(const char *file_name, const char **dset_names, int num_dsets, int num_threads,
-                    bool do_on_worker) {
+                    bool do_on_worker, bool use_manifest) {
   std::vector<std::thread> threads;
 
-  hid_t file_id = H5Fcreate(file_name, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-  assert(file_id >= 0);
+  hid_t file_id = create_write_file(file_name);
 
   const hsize_t dset_size = 64 * 1024 * 1024;
   hid_t dspace = H5Screate_simple(1, &dset_size, NULL);
   assert(dspace >= 0);
 
+  hid_t dcpl = create_write_dcpl(dset_size);
   std::vector<hid_t> dset_ids;
   for (int i = 0; i < num_dsets; ++i) {
     hid_t dataset_id = H5Dcreate(file_id, dset_names[i], H5T_NATIVE_ULONG, dspace,
-                                 H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+                                 H5P_DEFAULT, dcpl, H5P_DEFAULT);
     assert(dataset_id >= 0);
     dset_ids.push_back(dataset_id);
   }
+  assert(H5Pclose(dcpl) >= 0);
 
   std::vector<u64> data(dset_size);
   for (size_t i = 0; i < dset_size; ++i) {
     data[i] = i;
   }
+  if (use_manifest) {
+    write_uniform_manifest(file_name, dset_names, num_dsets, data.data(), dset_size * sizeof(u64));
+  }
 
   auto write_func = [&data, dset_names](int dset_index, const std::vector<hid_t> &dset_ids,
                                         int name_index, hid_t mspace_id, hid_t fspace_id,
                                         void *buf, int elems_written) {
-    assert(H5Dwrite(dset_ids[dset_index], H5T_NATIVE_ULONG, mspace_id, fspace_id, H5P_DEFAULT,
-                    buf) >= 0);
+    assert(TRACE_CALL("H5Dwrite", H5Dwrite(dset_ids[dset_index], H5T_NATIVE_ULONG, mspace_id,
+                                           fspace_id, H5P_DEFAULT, buf)) >= 0);
     fprintf(stderr, "Wrote %d of %zu elements to dataset %s\n", elems_written, (size_t)dset_size,
             dset_names[name_index]);
-    assert(H5Dclose(dset_ids[dset_index]) <= 0);
   };
 
-  auto start = now();
-  auto end = now();
+  const uint64_t total_bytes = (uint64_t)num_dsets * dset_size * sizeof(u64);
+  if (g_alloc_options.preallocate) {
+    preallocate_file(file_id, dset_ids, dset_size * sizeof(u64), num_threads);
+  }
+  Phase phase("write", do_on_worker, num_threads, do_on_worker ? num_threads : num_dsets,
+              total_bytes);
 
   if (do_on_worker) {
     if (num_threads != num_dsets) {
@@ -135,51 +434,85 @@ void write_datasets(const char *file_name, const char **dset_names, int num_dset
         offset += count;
       }
       // NOTE(chogan): Each thread writes num_elems / num_threads elements
-      start = now();
+      start_phase(&phase);
       for (int i = 0; i < num_threads; ++i) {
         size_t data_offset = i * count;
         int name_index = num_dsets == 1 ? 0 : i;
-        threads.push_back(std::thread(write_func, i, local_dset_ids, name_index, mspace, dspaces[i],
-                                      data.data() + data_offset, count));
+        threads.push_back(spawn_worker(&phase, i, write_func, i, local_dset_ids, name_index,
+                                       mspace, dspaces[i], data.data() + data_offset, count));
       }
 
-      for (int i = 0; i < num_threads; ++i) {
-        threads[i].join();
-      }
-      end = now();
+      join_workers(threads);
+      end_phase(&phase);
 
       // NOTE(chogan): Close resources
       assert(H5Sclose(mspace) >= 0);
       for (int i = 0; i < num_threads; ++i) {
         assert(H5Sclose(dspaces[i]) >= 0);
       }
+      dset_ids.insert(dset_ids.end(), local_dset_ids.begin(), local_dset_ids.end());
     } else {
       // NOTE(chogan): Each thread writes a whole dataset
-      start = now();
+      start_phase(&phase);
       for (int i = 0; i < num_threads; ++i) {
-        threads.push_back(std::thread(write_func, i, dset_ids, i, H5S_ALL, H5S_ALL, data.data(),
-                                      dset_size));
+        threads.push_back(spawn_worker(&phase, i, write_func, i, dset_ids, i, H5S_ALL, H5S_ALL,
+                                       data.data(), dset_size));
       }
 
-      for (int i = 0; i < num_threads; ++i) {
-        threads[i].join();
-      }
-      end = now();
+      join_workers(threads);
+      end_phase(&phase);
     }
   } else {
-    start = now();
+    start_phase(&phase);
     for (int i = 0; i < num_dsets; ++i) {
       write_func(i, dset_ids, i, H5S_ALL, H5S_ALL, data.data(), dset_size);
     }
-    end = now();
+    end_phase(&phase);
   }
 
-  double total_seconds = std::chrono::duration<double>(end - start).count();
   fprintf(stderr, "Total seconds to write %d datasets with %d threads: %f\n", num_dsets,
-          do_on_worker ? num_threads : 1, total_seconds);
+          phase.num_threads, phase.seconds);
+  report_phase_counters(stderr, &phase);
 
   assert(H5Sclose(dspace) >= 0);
-  assert(H5Fclose(file_id) >= 0);
+  flush_and_close(file_id, dset_ids);
+}
+
+static hid_t create_read_fapl() {
+  hid_t result = H5Pcreate(H5P_FILE_ACCESS);
+  assert(result >= 0);
+  if (g_sieve_bytes) {
+    assert(H5Pset_sieve_buf_size(result, g_sieve_bytes) >= 0);
+  }
+  if (g_page_buffer_bytes) {
+    assert(H5Pset_page_buffer_size(result, g_page_buffer_bytes, 0, 0) >= 0);
+  }
+
+  return result;
+}
+
+// NOTE(chogan): Reads `count` elements starting at `offset` with one H5Dread
+// per g_request_elems elements
+static void read_in_requests(hid_t dset_id, hsize_t offset, hsize_t count, u64 *dest) {
+  hsize_t request = std::min(g_request_elems, count);
+  hid_t fspace = H5Dget_space(dset_id);
+  assert(fspace >= 0);
+  hid_t mspace = H5Screate_simple(1, &request, NULL);
+  assert(mspace >= 0);
+  for (hsize_t done = 0; done < count; done += request) {
+    hsize_t start = offset + done;
+    hsize_t elems = std::min(request, count - done);
+    if (elems != request) {
+      assert(H5Sclose(mspace) >= 0);
+      mspace = H5Screate_simple(1, &elems, NULL);
+      assert(mspace >= 0);
+    }
+    assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &start, NULL, &elems, NULL) >= 0);
+    assert(TRACE_CALL("H5Dread", H5Dread(dset_id, H5T_STD_I64LE, mspace, fspace, H5P_DEFAULT,
+                                         dest + done)) >= 0);
+  }
+  assert(H5Sclose(mspace) >= 0);
+  assert(H5Sclose(fspace) >= 0);
 }
 
 void read_datasets(const std::vector<hid_t> &dset_ids, const char **dset_names, int num_dsets,
@@ -187,14 +520,21 @@ void read_datasets(const std::vector<hid_t> &dset_ids, const char **dset_names,
   std::vector<std::thread> threads;
 
   auto read_func = [&dset_ids, &dset_names](int dset_index, int name_index, hid_t mspace_id,
-                                            hid_t fspace_id, u64 *dest, int elems_read) {
-    assert(H5Dread(dset_ids[dset_index], H5T_STD_I64LE, mspace_id, fspace_id, H5P_DEFAULT, dest) >= 0);
+                                            hid_t fspace_id, u64 *dest, int elems_read,
+                                            hsize_t file_offset) {
+    if (g_request_elems && g_request_elems < (hsize_t)elems_read) {
+      read_in_requests(dset_ids[dset_index], file_offset, elems_read, dest);
+    } else {
+      assert(TRACE_CALL("H5Dread", H5Dread(dset_ids[dset_index], H5T_STD_I64LE, mspace_id,
+                                           fspace_id, H5P_DEFAULT, dest)) >= 0);
+    }
     fprintf(stderr, "Read %zu of %d elements from dataset %s\n", (size_t)elems_read, dset_size,
             dset_names[name_index]);
   };
 
-  auto start = now();
-  auto end = now();
+  const uint64_t total_bytes = (uint64_t)num_dsets * dset_size * sizeof(u64);
+  Phase phase("read", do_on_worker, num_threads, do_on_worker ? num_threads : num_dsets,
+              total_bytes);
 
   if (do_on_worker) {
     if (num_threads != (int)num_dsets) {
@@ -223,18 +563,16 @@ void read_datasets(const std::vector<hid_t> &dset_ids, const char **dset_names,
       }
 
       // NOTE(chogan): Each thread reads num_elems / num_threads elements
-      start = now();
+      start_phase(&phase);
       for (int i = 0; i < num_threads; ++i) {
         size_t dest_offset = i * count;
         int name_index = num_dsets == 1 ? 0 : i;
-        threads.push_back(std::thread(read_func, i, name_index, mspace, dspaces[i],
-                                      dests[0] + dest_offset, count));
+        threads.push_back(spawn_worker(&phase, i, read_func, i, name_index, mspace, dspaces[i],
+                                       dests[0] + dest_offset, count, dest_offset));
       }
 
-      for (int i = 0; i < num_threads; ++i) {
-        threads[i].join();
-      }
-      end = now();
+      join_workers(threads);
+      end_phase(&phase);
 
       for (int i = 0; i < num_threads; ++i) {
         assert(H5Sclose(dspaces[i]) >= 0);
@@ -242,28 +580,27 @@ void read_datasets(const std::vector<hid_t> &dset_ids, const char **dset_names,
       assert(H5Sclose(mspace) >= 0);
     } else {
       // NOTE(chogan): Each thread reads a whole dataset
-      start = now();
+      start_phase(&phase);
       for (int i = 0; i < num_threads; ++i) {
-        threads.push_back(std::thread(read_func, i, i, H5S_ALL, H5S_ALL, dests[i], dset_size));
+        threads.push_back(spawn_worker(&phase, i, read_func, i, i, H5S_ALL, H5S_ALL, dests[i],
+                                       dset_size, 0));
       }
 
-      for (int i = 0; i < num_threads; ++i) {
-        threads[i].join();
-      }
-      end = now();
+      join_workers(threads);
+      end_phase(&phase);
     }
   } else {
     // NOTE(chogan): One thread reads all datasets
-    start = now();
+    start_phase(&phase);
     for (int i = 0; i < num_dsets; ++i) {
-      read_func(i, i, H5S_ALL, H5S_ALL, dests[i], dset_size);
+      read_func(i, i, H5S_ALL, H5S_ALL, dests[i], dset_size, 0);
     }
-    end = now();
+    end_phase(&phase);
   }
 
-  double total_seconds = std::chrono::duration<double>(end - start).count();
   fprintf(stderr, "Total seconds to read %d datasets with %d threads: %f\n", num_dsets,
-          do_on_worker ? num_threads : 1, total_seconds);
+          phase.num_threads, phase.seconds);
+  report_phase_counters(stderr, &phase);
 }
 
 void close_datasets(const std::vector<hid_t> &dset_ids, const char **dset_names, int num_dsets,
@@ -271,207 +608,3451 @@ void close_datasets(const std::vector<hid_t> &dset_ids, const char **dset_names,
   std::vector<std::thread> threads;
 
   auto close_func = [&dset_ids, &dset_names](int dset_index, int name_index) {
-    assert(H5Dclose(dset_ids[dset_index]) >= 0);
+    assert(TRACE_CALL("H5Dclose", H5Dclose(dset_ids[dset_index])) >= 0);
     fprintf(stderr, "Closed %s\n", dset_names[name_index]);
   };
 
-  auto start = now();
-  auto end = now();
+  Phase phase("close", do_on_worker, num_threads,
+              do_on_worker ? num_threads : dset_ids.size(), 0);
 
   if (do_on_worker) {
     if (num_threads != num_dsets) {
       assert(num_dsets == 1);
     }
 
-    start = now();
+    start_phase(&phase);
     for (int i = 0; i < num_threads; ++i) {
       int name_index = num_dsets == 1 ? 0 : i;
-      threads.push_back(std::thread(close_func, i, name_index));
+      threads.push_back(spawn_worker(&phase, i, close_func, i, name_index));
     }
 
-    for (int i = 0; i < num_threads; ++i) {
-      threads[i].join();
-    }
-    end = now();
+    join_workers(threads);
+    end_phase(&phase);
   } else {
-    start = now();
+    start_phase(&phase);
     for (size_t i = 0; i < dset_ids.size(); ++i) {
       int name_index = num_dsets == 1 ? 0 : i;
       close_func(i, name_index);
     }
-    end = now();
+    end_phase(&phase);
   }
 
-  double total_seconds = std::chrono::duration<double>(end - start).count();
   fprintf(stderr, "Total seconds to close %d datasets with %d threads: %f\n", num_dsets,
-          do_on_worker ? num_threads : 1, total_seconds);
+          phase.num_threads, phase.seconds);
+  report_phase_counters(stderr, &phase);
 }
 
-
-void verify_datasets(int num_dsets, int dset_size, u64 **destinations) {
+// NOTE(chogan): Reads each dataset once, untimed, so the first of several timed
+// runs over the same file doesn't also pay for pulling it into the page cache.
+// With `dests` the data is read the way the timed reads do, into the buffers
+// they will use, so faulting those in is paid here too. Without it each
+// dataset is read in its native type into a scratch buffer.
+static void prime_datasets(const char *file_name, const char **dset_names, int num_dsets,
+                           u64 **dests) {
+  hid_t file_id = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+  assert(file_id >= 0);
+  std::vector<char> scratch;
   for (int i = 0; i < num_dsets; ++i) {
-    u64 counter = 0;
-    u64 *current_dset = destinations[i];
-    for (int j = 0; j < dset_size; ++j) {
-      assert(current_dset[j] == counter++);
+    hid_t dset_id = H5Dopen(file_id, dset_names[i], H5P_DEFAULT);
+    assert(dset_id >= 0);
+    if (dests) {
+      assert(H5Dread(dset_id, H5T_STD_I64LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, dests[i]) >= 0);
+    } else {
+      hid_t type = H5Dget_type(dset_id);
+      assert(type >= 0);
+      hid_t mem_type = H5Tget_native_type(type, H5T_DIR_DEFAULT);
+      assert(mem_type >= 0);
+      hid_t space = H5Dget_space(dset_id);
+      assert(space >= 0);
+      hssize_t num_elems = H5Sget_simple_extent_npoints(space);
+      assert(num_elems >= 0);
+      scratch.resize(std::max((size_t)num_elems * H5Tget_size(mem_type), (size_t)1));
+      assert(H5Dread(dset_id, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, scratch.data()) >= 0);
+      assert(H5Sclose(space) >= 0);
+      assert(H5Tclose(mem_type) >= 0);
+      assert(H5Tclose(type) >= 0);
     }
+    assert(H5Dclose(dset_id) >= 0);
   }
+  assert(H5Fclose(file_id) >= 0);
 }
 
-void usage(const char *prog) {
-  fprintf(stderr, "Usage: %s -f file_name [-t num_threads] [-d num_dsets] [-o,-c,-r,-s]\n", prog);
-  fprintf(stderr, "    -c: Close datasets in the worker threads\n");
-  fprintf(stderr, "    -o: Open datasets in the worker threads\n");
-  fprintf(stderr, "    -r: Read datasets in the worker threads\n");
-  fprintf(stderr, "    -s: Skip verification of results\n");
-  exit(1);
+//
+// Pipelined writes
+//
+
+// NOTE(chogan): write_datasets generates all of its data before the timed
+// phase. Here the data is streamed instead: producer threads fill windows of a
+// fixed pool of buffers while writer threads write full windows with hyperslab
+// H5Dwrites and return the buffers to the pool. With -H, producers also hash
+// each verification block of a window as they fill it, so the manifest can be
+// written without ever holding a whole dataset in memory.
+struct PipelineOptions {
+  bool enabled;
+  int num_producers;
+  int num_buffers;
+  hsize_t window_elems;
+};
+
+// NOTE(chogan): Blocking FIFO of buffer indices. Pops return false once the
+// queue is closed and drained.
+struct BufferQueue {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<int> buffers;
+  bool closed;
+};
+
+static void push_buffer(BufferQueue *queue, int buffer) {
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->buffers.push_back(buffer);
+  }
+  queue->cv.notify_one();
 }
 
-int main (int argc, char* argv[]) {
+static void close_buffer_queue(BufferQueue *queue) {
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->closed = true;
+  }
+  queue->cv.notify_all();
+}
 
-  if (argc < 2) {
-    usage(argv[0]);
+// NOTE(chogan): Adds the time spent blocked to `stall_ns`
+static bool pop_buffer(BufferQueue *queue, int *buffer, std::atomic<uint64_t> *stall_ns) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (queue->buffers.empty() && !queue->closed) {
+    int64_t start_ns = trace_now_ns();
+    queue->cv.wait(lock, [queue]() { return !queue->buffers.empty() || queue->closed; });
+    int64_t end_ns = trace_now_ns();
+    *stall_ns += end_ns - start_ns;
+    if (g_trace_enabled) {
+      record_trace_event("buffer wait", "lock", start_ns, end_ns);
+    }
   }
+  if (queue->buffers.empty()) {
+    return false;
+  }
+  *buffer = queue->buffers.front();
+  queue->buffers.pop_front();
 
-  int option = -1;
-  int num_threads = 1;
-  int num_dsets = 8;
-  char *in_file_name = 0;
-  char *out_file_name = 0;
-  bool verify_results = true;
-  bool do_write = false;
-  bool open_on_workers = false;
-  bool read_on_workers = false;
-  bool write_on_workers = false;
-  bool close_on_workers = false;
+  return true;
+}
 
-  while ((option = getopt(argc, argv, "acd:f:orst:w:")) != -1) {
-    switch (option) {
-      case 'a': {
-        write_on_workers = true;
-        break;
-      }
-      case 'c': {
-        close_on_workers = true;
-        break;
-      }
-      case 'd': {
-        num_dsets = atoi(optarg);
-        assert(num_dsets <= max_dsets);
-        break;
-      }
-      case 'f': {
-        in_file_name = optarg;
-        break;
+void write_pipelined(const char *file_name, const char **dset_names, int num_dsets,
+                     int num_writers, const PipelineOptions &options, bool use_manifest) {
+  const hsize_t window_elems = options.window_elems;
+  assert(dset_size % window_elems == 0);
+  assert(window_elems % kVerifyBlockElems == 0);
+  const int num_producers = options.num_producers;
+  const int num_buffers = options.num_buffers;
+  const hsize_t windows_per_dset = dset_size / window_elems;
+  const hsize_t num_windows = windows_per_dset * num_dsets;
+  const size_t blocks_per_window = window_elems / kVerifyBlockElems;
+
+  hid_t file_id = create_write_file(file_name);
+  const hsize_t dims = dset_size;
+  hid_t dspace = H5Screate_simple(1, &dims, NULL);
+  assert(dspace >= 0);
+  hid_t dcpl = create_write_dcpl(dims);
+  std::vector<hid_t> dset_ids;
+  for (int i = 0; i < num_dsets; ++i) {
+    hid_t dset_id = H5Dcreate(file_id, dset_names[i], H5T_NATIVE_ULONG, dspace, H5P_DEFAULT,
+                              dcpl, H5P_DEFAULT);
+    assert(dset_id >= 0);
+    dset_ids.push_back(dset_id);
+  }
+  assert(H5Pclose(dcpl) >= 0);
+  assert(H5Sclose(dspace) >= 0);
+
+  // NOTE(chogan): Each writer gets its own handle to every dataset, like the
+  // split write in write_datasets
+  std::vector<hid_t> writer_dset_ids;
+  for (int i = 0; i < num_writers; ++i) {
+    for (int j = 0; j < num_dsets; ++j) {
+      hid_t dset_id = H5Dopen(file_id, dset_names[j], H5P_DEFAULT);
+      assert(dset_id >= 0);
+      writer_dset_ids.push_back(dset_id);
+    }
+  }
+
+  std::vector<u64> pool((size_t)num_buffers * window_elems);
+  std::vector<hsize_t> buffer_windows(num_buffers);
+  std::vector<uint64_t> block_digests(num_windows * blocks_per_window);
+  BufferQueue free_queue;
+  free_queue.closed = false;
+  BufferQueue ready_queue;
+  ready_queue.closed = false;
+  for (int i = 0; i < num_buffers; ++i) {
+    push_buffer(&free_queue, i);
+  }
+  std::atomic<hsize_t> next_window(0);
+  std::atomic<int> producers_left(num_producers);
+  std::atomic<uint64_t> producer_stall_ns(0);
+  std::atomic<uint64_t> writer_stall_ns(0);
+
+  auto produce_func = [&]() {
+    for (hsize_t window = next_window++; window < num_windows; window = next_window++) {
+      int buffer = 0;
+      bool popped = pop_buffer(&free_queue, &buffer, &producer_stall_ns);
+      assert(popped);
+      (void)popped;
+      u64 *data = &pool[(size_t)buffer * window_elems];
+      const u64 first = (window % windows_per_dset) * window_elems;
+      for (hsize_t i = 0; i < window_elems; ++i) {
+        data[i] = first + i;
       }
-      case 'o': {
-        open_on_workers = true;
-        break;
+      for (size_t i = 0; use_manifest && i < blocks_per_window; ++i) {
+        block_digests[window * blocks_per_window + i] =
+            xxh64(data + i * kVerifyBlockElems, kVerifyBlockBytes, 0);
       }
-      case 'r': {
-        read_on_workers = true;
-        break;
+      buffer_windows[buffer] = window;
+      push_buffer(&ready_queue, buffer);
+    }
+    if (--producers_left == 0) {
+      close_buffer_queue(&ready_queue);
+    }
+  };
+
+  auto write_func = [&](int writer) {
+    hid_t mspace = H5Screate_simple(1, &window_elems, NULL);
+    assert(mspace >= 0);
+    hid_t fspace = H5Screate_simple(1, &dims, NULL);
+    assert(fspace >= 0);
+    int buffer = 0;
+    while (pop_buffer(&ready_queue, &buffer, &writer_stall_ns)) {
+      const hsize_t window = buffer_windows[buffer];
+      const hsize_t offset = (window % windows_per_dset) * window_elems;
+      hid_t dset_id = writer_dset_ids[writer * num_dsets + window / windows_per_dset];
+      assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &window_elems,
+                                 NULL) >= 0);
+      assert(TRACE_CALL("H5Dwrite", H5Dwrite(dset_id, H5T_NATIVE_ULONG, mspace, fspace,
+                                             H5P_DEFAULT,
+                                             &pool[(size_t)buffer * window_elems])) >= 0);
+      push_buffer(&free_queue, buffer);
+    }
+    assert(H5Sclose(fspace) >= 0);
+    assert(H5Sclose(mspace) >= 0);
+  };
+
+  const uint64_t total_bytes = (uint64_t)num_dsets * dset_size * sizeof(u64);
+  if (g_alloc_options.preallocate) {
+    preallocate_file(file_id, dset_ids, dset_size * sizeof(u64), num_writers);
+  }
+  Phase phase("pipeline write", true, num_producers + num_writers, num_windows, total_bytes);
+  std::vector<std::thread> threads;
+  start_phase(&phase);
+  for (int i = 0; i < num_producers; ++i) {
+    threads.push_back(spawn_worker(&phase, i, produce_func));
+  }
+  for (int i = 0; i < num_writers; ++i) {
+    threads.push_back(spawn_worker(&phase, num_producers + i, write_func, i));
+  }
+  join_workers(threads);
+  end_phase(&phase);
+
+  fprintf(stderr, "Total seconds to write %d datasets with %d producers and %d writers: %f "
+          "(%f GB/s)\n", num_dsets, num_producers, num_writers, phase.seconds,
+          total_bytes / phase.seconds / (1024.0 * 1024.0 * 1024.0));
+  fprintf(stderr, "    %llu windows of %llu elements through %d buffers, producers stalled %f "
+          "seconds, writers stalled %f seconds\n", (unsigned long long)num_windows,
+          (unsigned long long)window_elems, num_buffers, producer_stall_ns / 1e9,
+          writer_stall_ns / 1e9);
+  report_phase_counters(stderr, &phase);
+
+  dset_ids.insert(dset_ids.end(), writer_dset_ids.begin(), writer_dset_ids.end());
+  flush_and_close(file_id, dset_ids);
+  if (!use_manifest) {
+    return;
+  }
+
+  // NOTE(chogan): Same digest as hash_buffers: XXH64 over the block digests
+  const size_t blocks_per_dset = windows_per_dset * blocks_per_window;
+  std::vector<ManifestEntry> entries;
+  for (int i = 0; i < num_dsets; ++i) {
+    uint64_t digest = xxh64(&block_digests[i * blocks_per_dset],
+                            blocks_per_dset * sizeof(uint64_t), 0);
+    entries.push_back({dset_names[i], (uint64_t)dset_size * sizeof(u64), digest});
+  }
+  write_manifest(file_name, entries);
+}
+
+// NOTE(chogan): Results that forked processes report back to the parent.
+// Lives in a MAP_SHARED mapping created before the fork.
+const int kNumProcessPhases = 3;
+const char *process_phase_names[kNumProcessPhases] = {"open", "read", "close"};
+
+struct ProcessResults {
+  pthread_barrier_t barrier;
+  int64_t start_ns[kNumProcessPhases][max_threads];
+  int64_t end_ns[kNumProcessPhases][max_threads];
+  PerfValues counters[kNumProcessPhases][max_threads];
+};
+
+// NOTE(chogan): Timestamps compared across processes come from CLOCK_MONOTONIC,
+// which every process shares
+static uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// NOTE(chogan): Waits for every child in `pids`. If one fails, the rest are
+// killed, since they would wait on a shared barrier forever.
+bool wait_for_children(const std::vector<pid_t> &pids) {
+  bool result = true;
+  for (size_t remaining = pids.size(); remaining > 0; --remaining) {
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, 0);
+    assert(pid > 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Process %d failed\n", (int)pid);
+      if (result) {
+        for (pid_t other : pids) {
+          if (other != pid) {
+            kill(other, SIGKILL);
+          }
+        }
       }
-      case 's': {
-        verify_results = false;
+      result = false;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(chogan): Creates a barrier for `count` processes in a MAP_SHARED mapping
+void init_process_barrier(pthread_barrier_t *barrier, int count) {
+  pthread_barrierattr_t attr;
+  assert(pthread_barrierattr_init(&attr) == 0);
+  assert(pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == 0);
+  assert(pthread_barrier_init(barrier, &attr, count) == 0);
+  assert(pthread_barrierattr_destroy(&attr) == 0);
+}
+
+void wait_process_barrier(pthread_barrier_t *barrier) {
+  TRACE_SCOPE("process barrier", "barrier");
+  int err = pthread_barrier_wait(barrier);
+  assert(err == 0 || err == PTHREAD_BARRIER_SERIAL_THREAD);
+}
+
+// NOTE(chogan): A forked child inherits the forking thread's trace buffer,
+// along with its events and tid. Drops them (they belong to the parent's
+// trace) so the child records into a fresh buffer under its own tid.
+static void reset_trace_after_fork() {
+  g_trace_buffers.store(nullptr, std::memory_order_relaxed);
+  t_trace_buffer = nullptr;
+}
+
+// NOTE(chogan): The body of one forked process. It does what worker thread
+// `index` does in the threaded mode, but with its own copy of the library
+// state: open the file, then open, read, and close its dataset (or its
+// hyperslab of dataset 'a'), waiting on the shared barrier before each phase.
+int run_process_worker(ProcessResults *results, const char *file_name, const char **dset_names,
+                       int num_dsets, int num_procs, int index, bool verify_results,
+                       bool use_manifest, const char *trace_file_name) {
+  pin_current_thread(index);
+  reset_trace_after_fork();
+  char thread_name[32];
+  snprintf(thread_name, sizeof(thread_name), "process %d", index);
+  set_trace_thread_name(thread_name);
+
+  const bool split = num_dsets == 1;
+  const hsize_t count = split ? dset_size / num_procs : dset_size;
+  const hsize_t offset = split ? index * count : 0;
+  const char *dset_name = dset_names[split ? 0 : index];
+  u64 *dest = (u64 *)malloc(count * sizeof(u64));
+  assert(dest);
+
+  // NOTE(chogan): Each child starts cold, so warm it up the same way as the
+  // threaded mode before the timed phases
+  warm_up_library(false);
+  hid_t file_id = TRACE_CALL("H5Fopen", H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT));
+  assert(file_id >= 0 && "Failed to open file");
+
+  hid_t dset_id = -1;
+  hid_t mspace = H5S_ALL;
+  hid_t fspace = H5S_ALL;
+
+  for (int phase_index = 0; phase_index < kNumProcessPhases; ++phase_index) {
+    Phase phase(process_phase_names[phase_index], false, 1, 1,
+                phase_index == 1 ? count * sizeof(u64) : 0);
+
+    if (phase_index == 1 && split) {
+      // NOTE(chogan): Set up the partial read outside the timed region, like
+      // the threaded mode does on the main thread.
+      const hsize_t stride = 1;
+      const hsize_t block = 1;
+      mspace = H5Screate_simple(1, &count, NULL);
+      assert(mspace >= 0);
+      fspace = H5Dget_space(dset_id);
+      assert(fspace >= 0);
+      assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, &stride, &count, &block) >= 0);
+    }
+
+    wait_process_barrier(&results->barrier);
+
+    start_phase(&phase);
+    results->start_ns[phase_index][index] = monotonic_ns();
+    switch (phase_index) {
+      case 0: {
+        dset_id = TRACE_CALL("H5Dopen", H5Dopen(file_id, dset_name, H5P_DEFAULT));
+        assert(dset_id >= 0);
         break;
       }
-      case 't': {
-        num_threads = atoi(optarg);
-        assert(num_threads <= max_dsets);
+      case 1: {
+        assert(TRACE_CALL("H5Dread", H5Dread(dset_id, H5T_STD_I64LE, mspace, fspace, H5P_DEFAULT,
+                                             dest)) >= 0);
         break;
       }
-      case 'w': {
-        do_write = true;
-        out_file_name = optarg;
+      case 2: {
+        assert(TRACE_CALL("H5Dclose", H5Dclose(dset_id)) >= 0);
         break;
       }
-      default:
-        usage(argv[0]);
     }
-  }
+    results->end_ns[phase_index][index] = monotonic_ns();
+    end_phase(&phase);
 
-  if (optind < argc) {
-    fprintf(stderr, "Got unknown argument '%s'.\n", argv[optind]);
-    usage(argv[0]);
+    results->counters[phase_index][index] = phase.counters;
   }
 
-  assert(do_write ? out_file_name : in_file_name);
-  assert((num_threads == num_dsets || num_threads == 1 || num_dsets == 1) && "Invalid configuration");
-  if (num_dsets == 1) {
-    assert(dset_size % num_threads == 0);
+  if (split) {
+    assert(H5Sclose(mspace) >= 0);
+    assert(H5Sclose(fspace) >= 0);
   }
+  assert(TRACE_CALL("H5Fclose", H5Fclose(file_id)) >= 0);
 
-  u64 *a = (u64 *)malloc(dset_size * sizeof(u64));
-  u64 *b = (u64 *)malloc(dset_size * sizeof(u64));
-  u64 *c = (u64 *)malloc(dset_size * sizeof(u64));
-  u64 *d = (u64 *)malloc(dset_size * sizeof(u64));
-  u64 *e = (u64 *)malloc(dset_size * sizeof(u64));
-  u64 *f = (u64 *)malloc(dset_size * sizeof(u64));
-  u64 *g = (u64 *)malloc(dset_size * sizeof(u64));
-  u64 *h = (u64 *)malloc(dset_size * sizeof(u64));
+  if (trace_file_name) {
+    char name[4096];
+    snprintf(name, sizeof(name), "%s.%d", trace_file_name, index);
+    write_trace(name);
+  }
 
-  const char *dset_names[] = {"a", "b", "c", "d", "e", "f", "g", "h"};
-  u64 *destinations[] = {a, b, c, d, e, f, g, h};
-  const int num_ids = num_threads == 1 ? num_dsets : num_threads;
-  std::vector<hid_t> dset_ids(num_ids);
+  int result = 0;
+  if (verify_results && use_manifest && !split) {
+    const char *names[] = {dset_name};
+    result = verify_datasets_against_manifest(file_name, names, 1, dset_size, &dest) ? 0 : 1;
+  } else if (verify_results) {
+    // NOTE(chogan): A hyperslab can't be checked against a whole dataset
+    // digest, so split reads are always checked against the arange contents.
+    const char *kernel_name = 0;
+    SequenceKernel kernel = select_sequence_kernel(&kernel_name);
+    hsize_t mismatch = kernel(dest, count, offset);
+    if (mismatch < count) {
+      fprintf(stderr, "Process %d: element %llu of %s is %llu\n", index,
+              (unsigned long long)(offset + mismatch), dset_name,
+              (unsigned long long)dest[mismatch]);
+      result = 1;
+    }
+  }
+  free(dest);
+  H5close();
 
-  if (do_write) {
-    write_datasets(out_file_name, dset_names, num_dsets, num_threads, write_on_workers);
-  } else {
-    hid_t file_id = H5Fopen(in_file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
-    assert(file_id >= 0 && "Failed to open file");
+  return result;
+}
 
-    // NOTE(chogan): Normally this gets initialized in H5Dopen. Do it here so all
-    // initialization is complete before starting worker threads.
-    assert(H5S__init_package() >= 0);
-    H5S_init_g = 1;
+// NOTE(chogan): Runs the open, read, and close phases in `num_procs` forked
+// processes instead of threads. This is the ceiling the threaded numbers are
+// trying to reach, since each process has its own library state and locks.
+bool run_processes(const char *file_name, const char **dset_names, int num_dsets, int num_procs,
+                   bool verify_results, bool use_manifest, const char *trace_file_name) {
+  assert(num_procs <= max_threads);
+  assert(num_dsets == 1 || num_dsets == num_procs);
+
+  ProcessResults *results = (ProcessResults *)mmap(0, sizeof(ProcessResults),
+                                                   PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(results != MAP_FAILED);
+  memset(results, 0, sizeof(ProcessResults));
+
+  init_process_barrier(&results->barrier, num_procs);
+
+  // NOTE(chogan): Flush before forking so buffered output isn't duplicated
+  fflush(stdout);
+  fflush(stderr);
+
+  std::vector<pid_t> pids;
+  for (int i = 0; i < num_procs; ++i) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      _exit(run_process_worker(results, file_name, dset_names, num_dsets, num_procs, i,
+                               verify_results, use_manifest, trace_file_name));
+    }
+    pids.push_back(pid);
+  }
 
-    open_datasets(file_id, dset_ids, dset_names, num_dsets, num_threads, open_on_workers);
-    read_datasets(dset_ids, dset_names, num_dsets, destinations, num_threads, read_on_workers);
-    close_datasets(dset_ids, dset_names, num_dsets, num_threads, close_on_workers);
+  bool success = wait_for_children(pids);
+
+  if (success) {
+    const uint64_t total_bytes = (uint64_t)num_dsets * dset_size * sizeof(u64);
+    for (int phase_index = 0; phase_index < kNumProcessPhases; ++phase_index) {
+      Phase phase(process_phase_names[phase_index], true, num_procs, num_procs,
+                  phase_index == 1 ? total_bytes : 0);
+      int64_t start_ns = results->start_ns[phase_index][0];
+      int64_t end_ns = results->end_ns[phase_index][0];
+      for (int i = 0; i < num_procs; ++i) {
+        start_ns = std::min(start_ns, results->start_ns[phase_index][i]);
+        end_ns = std::max(end_ns, results->end_ns[phase_index][i]);
+        add_perf_values(&phase.counters, results->counters[phase_index][i]);
+      }
+      phase.seconds = (end_ns - start_ns) / 1e9;
+      record_phase(&phase);
 
-    if (H5Fclose(file_id) < 0) {
-      fprintf(stderr, "Failed to close file\n");
+      fprintf(stderr, "Total seconds to %s %d datasets with %d processes: %f\n", phase.name,
+              num_dsets, num_procs, phase.seconds);
+      report_phase_counters(stderr, &phase);
     }
   }
 
-  // NOTE(chogan): Stop vtune collection so the computationally expensive
-  // verification isn't added to the profile
-  // __itt_pause();
+  pthread_barrier_destroy(&results->barrier);
+  munmap(results, sizeof(ProcessResults));
 
-  if (verify_results) {
-    fprintf(stderr, "Verifying results\n");
-    if (do_write) {
-      hid_t out_file_id = H5Fopen(out_file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
-      assert(out_file_id >= 0);
+  return success;
+}
 
-      for (int i = 0; i < num_dsets; ++i) {
-        hid_t dset_id = H5Dopen(out_file_id, dset_names[i], H5P_DEFAULT);
-        assert(dset_id >= 0);
-        assert(H5Dread(dset_id, H5T_NATIVE_ULONG, H5S_ALL, H5S_ALL, H5P_DEFAULT,
-                       destinations[i]) >= 0);
-        assert(H5Dclose(dset_id) >= 0);
-      }
+//
+// SWMR
+//
+
+// NOTE(chogan): One writer process appends timestamped records to an
+// extendible dataset in a file opened for SWMR writing, while readers in
+// other processes poll it with H5Drefresh. Processes are required because a
+// single library instance can't have the same file open for SWMR writing and
+// reading at once. Each record is the CLOCK_MONOTONIC time the writer began
+// the append, so a reader can measure end to end visibility latency (extend,
+// write, flush, refresh, read) by subtracting it from the time it sees it.
+struct SwmrOptions {
+  const char *file_name;
+  int max_readers;
+  double appends_per_second;
+  int records_per_append;
+  double seconds;
+  int poll_us;
+};
+
+const hsize_t kSwmrChunkElems = 1024;
+const char *kSwmrDatasetName = "records";
+
+struct SwmrShared {
+  pthread_barrier_t barrier;
+  std::atomic<int> writer_done;
+  uint64_t total_records;
+  double writer_seconds;
+  LatencyHistogram latency[max_threads];
+  uint64_t records_read[max_threads];
+  uint64_t refreshes[max_threads];
+  double reader_seconds[max_threads];
+};
+
+int run_swmr_writer(SwmrShared *shared, const SwmrOptions &options) {
+  pin_current_thread(0);
+
+  hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+  assert(fapl >= 0);
+  assert(H5Pset_libver_bounds(fapl, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST) >= 0);
+  hid_t file_id = H5Fcreate(options.file_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+  assert(file_id >= 0);
 
-      verify_datasets(num_dsets, dset_size, destinations);
+  const hsize_t initial_size = 0;
+  const hsize_t max_size = H5S_UNLIMITED;
+  hid_t dspace = H5Screate_simple(1, &initial_size, &max_size);
+  assert(dspace >= 0);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  assert(dcpl >= 0);
+  assert(H5Pset_chunk(dcpl, 1, &kSwmrChunkElems) >= 0);
+  hid_t dset_id = H5Dcreate(file_id, kSwmrDatasetName, H5T_NATIVE_UINT64, dspace, H5P_DEFAULT,
+                            dcpl, H5P_DEFAULT);
+  assert(dset_id >= 0);
+  assert(H5Fstart_swmr_write(file_id) >= 0);
+
+  // NOTE(chogan): Readers open the file after the first barrier and start
+  // polling after the second.
+  wait_process_barrier(&shared->barrier);
+  wait_process_barrier(&shared->barrier);
+
+  const hsize_t count = options.records_per_append;
+  const hsize_t stride = 1;
+  const hsize_t block = 1;
+  hid_t mspace = H5Screate_simple(1, &count, NULL);
+  assert(mspace >= 0);
+  std::vector<u64> records(count);
+
+  const uint64_t period_ns = (uint64_t)(1e9 / options.appends_per_second);
+  const uint64_t start_ns = monotonic_ns();
+  const uint64_t end_ns = start_ns + (uint64_t)(options.seconds * 1e9);
+  uint64_t next_ns = start_ns;
+  hsize_t appended = 0;
+
+  while (next_ns < end_ns) {
+    timespec next = {(time_t)(next_ns / 1000000000ULL), (long)(next_ns % 1000000000ULL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+    }
 
-      assert(H5Fclose(out_file_id) >= 0);
-      assert(remove(out_file_name) == 0);
-    } else {
-      verify_datasets(num_dsets, dset_size, destinations);
+    TRACE_SCOPE("append", "api");
+    u64 stamp = monotonic_ns();
+    for (hsize_t i = 0; i < count; ++i) {
+      records[i] = stamp;
     }
-    fprintf(stderr, "Success.\n");
+    hsize_t new_size = appended + count;
+    assert(H5Dset_extent(dset_id, &new_size) >= 0);
+    hid_t fspace = H5Dget_space(dset_id);
+    assert(fspace >= 0);
+    assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &appended, &stride, &count, &block) >= 0);
+    assert(H5Dwrite(dset_id, H5T_NATIVE_UINT64, mspace, fspace, H5P_DEFAULT,
+                    records.data()) >= 0);
+    assert(H5Sclose(fspace) >= 0);
+    assert(H5Dflush(dset_id) >= 0);
+    appended = new_size;
+    next_ns += period_ns;
   }
 
-  free(a);
-  free(b);
-  free(c);
-  free(d);
-  free(e);
-  free(f);
-  free(g);
-  free(h);
+  shared->total_records = appended;
+  shared->writer_seconds = (monotonic_ns() - start_ns) / 1e9;
+  shared->writer_done.store(1, std::memory_order_release);
+
+  assert(H5Sclose(mspace) >= 0);
+  assert(H5Dclose(dset_id) >= 0);
+  assert(H5Pclose(dcpl) >= 0);
+  assert(H5Sclose(dspace) >= 0);
+  assert(H5Fclose(file_id) >= 0);
+  assert(H5Pclose(fapl) >= 0);
+  H5close();
+
+  return 0;
+}
+
+int run_swmr_reader(SwmrShared *shared, const SwmrOptions &options, int index) {
+  pin_current_thread(index + 1);
+
+  wait_process_barrier(&shared->barrier);
+  hid_t file_id = H5Fopen(options.file_name, H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+  assert(file_id >= 0);
+  hid_t dset_id = H5Dopen(file_id, kSwmrDatasetName, H5P_DEFAULT);
+  assert(dset_id >= 0);
+  wait_process_barrier(&shared->barrier);
+
+  LatencyHistogram *latency = &shared->latency[index];
+  init_histogram(latency);
+  std::vector<u64> records;
+  hsize_t seen = 0;
+  uint64_t refreshes = 0;
+  const hsize_t stride = 1;
+  const hsize_t block = 1;
+  const uint64_t start_ns = monotonic_ns();
+
+  while (true) {
+    bool writer_done = shared->writer_done.load(std::memory_order_acquire);
+    hsize_t size = 0;
+    {
+      TRACE_SCOPE("poll", "api");
+      assert(H5Drefresh(dset_id) >= 0);
+      hid_t fspace = H5Dget_space(dset_id);
+      assert(fspace >= 0);
+      assert(H5Sget_simple_extent_dims(fspace, &size, NULL) == 1);
+      ++refreshes;
+
+      if (size > seen) {
+        hsize_t count = size - seen;
+        records.resize(count);
+        hid_t mspace = H5Screate_simple(1, &count, NULL);
+        assert(mspace >= 0);
+        assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &seen, &stride, &count, &block) >= 0);
+        assert(H5Dread(dset_id, H5T_NATIVE_UINT64, mspace, fspace, H5P_DEFAULT,
+                       records.data()) >= 0);
+        assert(H5Sclose(mspace) >= 0);
+
+        uint64_t visible_ns = monotonic_ns();
+        for (hsize_t i = 0; i < count; ++i) {
+          record_latency(latency, visible_ns - records[i]);
+        }
+        seen = size;
+      }
+      assert(H5Sclose(fspace) >= 0);
+    }
+
+    if (writer_done && seen >= shared->total_records) {
+      break;
+    }
+    if (size == seen && options.poll_us > 0) {
+      usleep(options.poll_us);
+    }
+  }
+
+  shared->reader_seconds[index] = (monotonic_ns() - start_ns) / 1e9;
+  shared->records_read[index] = seen;
+  shared->refreshes[index] = refreshes;
+
+  assert(H5Dclose(dset_id) >= 0);
+  assert(H5Fclose(file_id) >= 0);
+  H5close();
+
+  return 0;
+}
+
+// NOTE(chogan): Runs one writer against 1, 2, 4, ... max_readers readers and
+// reports visibility latency and reader throughput for each reader count.
+bool run_swmr(const SwmrOptions &options) {
+  assert(options.max_readers >= 1 && options.max_readers <= max_threads);
+  assert(options.records_per_append >= 1);
+  assert(options.appends_per_second > 0);
+
+  SwmrShared *shared = (SwmrShared *)mmap(0, sizeof(SwmrShared), PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(shared != MAP_FAILED);
+
+  fprintf(stderr, "SWMR: %f appends/sec of %d records for %f seconds, polling every %d us\n",
+          options.appends_per_second, options.records_per_append, options.seconds,
+          options.poll_us);
+
+  bool success = true;
+  for (int num_readers = 1; success; num_readers *= 2) {
+    num_readers = std::min(num_readers, options.max_readers);
+
+    memset((void *)shared, 0, sizeof(SwmrShared));
+    init_process_barrier(&shared->barrier, num_readers + 1);
+    fflush(stdout);
+    fflush(stderr);
+
+    std::vector<pid_t> pids;
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      _exit(run_swmr_writer(shared, options));
+    }
+    pids.push_back(pid);
+    for (int i = 0; i < num_readers; ++i) {
+      pid = fork();
+      assert(pid >= 0);
+      if (pid == 0) {
+        _exit(run_swmr_reader(shared, options, i));
+      }
+      pids.push_back(pid);
+    }
+
+    success = wait_for_children(pids);
+    pthread_barrier_destroy(&shared->barrier);
+    remove(options.file_name);
+
+    if (success) {
+      LatencyHistogram latency;
+      init_histogram(&latency);
+      double records_per_second = 0;
+      uint64_t refreshes = 0;
+      for (int i = 0; i < num_readers; ++i) {
+        merge_histogram(&latency, shared->latency[i]);
+        records_per_second += shared->records_read[i] / shared->reader_seconds[i];
+        refreshes += shared->refreshes[i];
+      }
+
+      fprintf(stderr, "SWMR with %d readers: appended %llu records in %f seconds (%f records/sec)\n",
+              num_readers, (unsigned long long)shared->total_records, shared->writer_seconds,
+              shared->total_records / shared->writer_seconds);
+      fprintf(stderr, "    visibility latency (us): mean %f p50 %f p99 %f max %f\n",
+              histogram_mean(latency) / 1e3, histogram_percentile(latency, 50) / 1e3,
+              histogram_percentile(latency, 99) / 1e3, latency.max_ns / 1e3);
+      fprintf(stderr, "    reader throughput: %f records/sec (%f MB/s) over %d readers, "
+              "%llu refreshes\n", records_per_second,
+              records_per_second * sizeof(u64) / (1024.0 * 1024.0), num_readers,
+              (unsigned long long)refreshes);
+    }
+
+    if (num_readers == options.max_readers) {
+      break;
+    }
+  }
+
+  munmap(shared, sizeof(SwmrShared));
+
+  return success;
+}
+
+//
+// Ingestion
+//
+
+// NOTE(chogan): Producer threads append records to one extendible chunked
+// dataset, the way our time series loggers do. Appends go into a per-thread
+// batch, and each full batch costs one H5Dset_extent and one hyperslab
+// H5Dwrite. Only the extent reservation is serialized by the harness.
+struct IngestOptions {
+  const char *file_name;
+  int num_producers;
+  uint64_t records_per_producer;
+  hsize_t records_per_batch;
+  std::vector<hsize_t> chunk_sizes;
+  // NOTE(chogan): H5Dflush after every `flush_every` batches. 0 never flushes.
+  int flush_every;
+};
+
+struct IngestRecord {
+  u64 time_ns;
+  u32 source;
+  u32 sequence;
+  double value;
+};
+
+static hid_t create_ingest_record_type() {
+  hid_t result = H5Tcreate(H5T_COMPOUND, sizeof(IngestRecord));
+  assert(result >= 0);
+  assert(H5Tinsert(result, "time_ns", HOFFSET(IngestRecord, time_ns), H5T_NATIVE_UINT64) >= 0);
+  assert(H5Tinsert(result, "source", HOFFSET(IngestRecord, source), H5T_NATIVE_UINT32) >= 0);
+  assert(H5Tinsert(result, "sequence", HOFFSET(IngestRecord, sequence), H5T_NATIVE_UINT32) >= 0);
+  assert(H5Tinsert(result, "value", HOFFSET(IngestRecord, value), H5T_NATIVE_DOUBLE) >= 0);
+
+  return result;
+}
+
+struct IngestState {
+  hid_t dset_id;
+  hid_t record_type;
+  int flush_every;
+  std::mutex extent_mutex;
+  hsize_t size;
+  uint64_t batches;
+  uint64_t flushes;
+  std::mutex histogram_mutex;
+  LatencyHistogram latency;
+  LatencyHistogram batch_latency;
+};
+
+static void write_ingest_batch(IngestState *state, const std::vector<IngestRecord> &batch) {
+  hsize_t count = batch.size();
+  hsize_t offset = 0;
+  bool flush = false;
+  {
+    TRACE_SCOPE("extent mutex", "lock");
+    std::lock_guard<std::mutex> lock(state->extent_mutex);
+    offset = state->size;
+    state->size += count;
+    assert(TRACE_CALL("H5Dset_extent", H5Dset_extent(state->dset_id, &state->size)) >= 0);
+    ++state->batches;
+    flush = state->flush_every > 0 && state->batches % state->flush_every == 0;
+    state->flushes += flush ? 1 : 0;
+  }
+
+  const hsize_t stride = 1;
+  const hsize_t block = 1;
+  hid_t mspace = H5Screate_simple(1, &count, NULL);
+  assert(mspace >= 0);
+  hid_t fspace = H5Dget_space(state->dset_id);
+  assert(fspace >= 0);
+  assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, &stride, &count, &block) >= 0);
+  assert(TRACE_CALL("H5Dwrite", H5Dwrite(state->dset_id, state->record_type, mspace, fspace,
+                                         H5P_DEFAULT, batch.data())) >= 0);
+  assert(H5Sclose(fspace) >= 0);
+  assert(H5Sclose(mspace) >= 0);
+
+  if (flush) {
+    assert(TRACE_CALL("H5Dflush", H5Dflush(state->dset_id)) >= 0);
+  }
+}
+
+static void ingest_producer(IngestState *state, const IngestOptions *options, int source) {
+  LatencyHistogram latency;
+  LatencyHistogram batch_latency;
+  init_histogram(&latency);
+  init_histogram(&batch_latency);
+  std::vector<IngestRecord> batch;
+  batch.reserve(options->records_per_batch);
+
+  for (uint64_t i = 0; i < options->records_per_producer; ++i) {
+    // NOTE(chogan): An append's latency includes the batch write it triggers,
+    // which is what shows up in the tail.
+    uint64_t start_ns = monotonic_ns();
+    batch.push_back({start_ns, (u32)source, (u32)i, i * 0.5});
+    if (batch.size() == options->records_per_batch) {
+      uint64_t batch_start_ns = monotonic_ns();
+      write_ingest_batch(state, batch);
+      batch.clear();
+      record_latency(&batch_latency, monotonic_ns() - batch_start_ns);
+    }
+    record_latency(&latency, monotonic_ns() - start_ns);
+  }
+  if (!batch.empty()) {
+    uint64_t batch_start_ns = monotonic_ns();
+    write_ingest_batch(state, batch);
+    record_latency(&batch_latency, monotonic_ns() - batch_start_ns);
+  }
+
+  std::lock_guard<std::mutex> lock(state->histogram_mutex);
+  merge_histogram(&state->latency, latency);
+  merge_histogram(&state->batch_latency, batch_latency);
+}
+
+// NOTE(chogan): Checks that every producer's records made it into the file
+// exactly once.
+static bool verify_ingest(hid_t dset_id, hid_t record_type, const IngestOptions &options) {
+  hid_t fspace = H5Dget_space(dset_id);
+  assert(fspace >= 0);
+  hsize_t size = 0;
+  assert(H5Sget_simple_extent_dims(fspace, &size, NULL) == 1);
+  assert(H5Sclose(fspace) >= 0);
+
+  uint64_t expected = options.num_producers * options.records_per_producer;
+  if (size != expected) {
+    fprintf(stderr, "Ingested %llu records, expected %llu\n", (unsigned long long)size,
+            (unsigned long long)expected);
+    return false;
+  }
+
+  std::vector<IngestRecord> records(size);
+  assert(H5Dread(dset_id, record_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, records.data()) >= 0);
+  std::vector<std::vector<bool>> seen(options.num_producers,
+                                      std::vector<bool>(options.records_per_producer));
+  for (const IngestRecord &record : records) {
+    if (record.source >= (u32)options.num_producers ||
+        record.sequence >= options.records_per_producer || seen[record.source][record.sequence] ||
+        record.value != record.sequence * 0.5) {
+      fprintf(stderr, "Bad or duplicate record from source %u, sequence %u\n", record.source,
+              record.sequence);
+      return false;
+    }
+    seen[record.source][record.sequence] = true;
+  }
+
+  return true;
+}
+
+bool run_ingest(const IngestOptions &options, bool verify_results) {
+  assert(options.records_per_batch >= 1);
+  hid_t record_type = create_ingest_record_type();
+  bool result = true;
+
+  fprintf(stderr, "Ingest: %d producers, %llu records each, %llu records per batch, flush every "
+          "%d batches\n", options.num_producers, (unsigned long long)options.records_per_producer,
+          (unsigned long long)options.records_per_batch, options.flush_every);
+
+  for (hsize_t chunk_size : options.chunk_sizes) {
+    g_phase_step = "chunk " + std::to_string(chunk_size);
+    hid_t file_id = H5Fcreate(options.file_name, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    assert(file_id >= 0);
+    const hsize_t initial_size = 0;
+    const hsize_t max_size = H5S_UNLIMITED;
+    hid_t dspace = H5Screate_simple(1, &initial_size, &max_size);
+    assert(dspace >= 0);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    assert(dcpl >= 0);
+    assert(H5Pset_chunk(dcpl, 1, &chunk_size) >= 0);
+
+    IngestState state;
+    state.dset_id = H5Dcreate(file_id, "records", record_type, dspace, H5P_DEFAULT, dcpl,
+                              H5P_DEFAULT);
+    assert(state.dset_id >= 0);
+    state.record_type = record_type;
+    state.flush_every = options.flush_every;
+    state.size = 0;
+    state.batches = 0;
+    state.flushes = 0;
+    init_histogram(&state.latency);
+    init_histogram(&state.batch_latency);
+
+    const uint64_t total_records = options.num_producers * options.records_per_producer;
+    const hsize_t batches_per_producer = ((options.records_per_producer +
+                                           options.records_per_batch - 1) /
+                                          options.records_per_batch);
+    Phase phase("ingest", true, options.num_producers,
+                options.num_producers * batches_per_producer * 2,
+                total_records * sizeof(IngestRecord));
+    std::vector<std::thread> threads;
+    start_phase(&phase);
+    for (int i = 0; i < options.num_producers; ++i) {
+      threads.push_back(spawn_worker(&phase, i, ingest_producer, &state, &options, i));
+    }
+    join_workers(threads);
+    end_phase(&phase);
+
+    fprintf(stderr, "Ingest with chunk size %llu: %llu records in %f seconds (%f records/sec, "
+            "%f MB/s), %llu batches, %llu flushes\n", (unsigned long long)chunk_size,
+            (unsigned long long)total_records, phase.seconds, total_records / phase.seconds,
+            phase.bytes / phase.seconds / (1024.0 * 1024.0), (unsigned long long)state.batches,
+            (unsigned long long)state.flushes);
+    fprintf(stderr, "    append latency (us): mean %f p50 %f p99 %f max %f\n",
+            histogram_mean(state.latency) / 1e3, histogram_percentile(state.latency, 50) / 1e3,
+            histogram_percentile(state.latency, 99) / 1e3, state.latency.max_ns / 1e3);
+    fprintf(stderr, "    batch latency (us): mean %f p50 %f p99 %f max %f\n",
+            histogram_mean(state.batch_latency) / 1e3,
+            histogram_percentile(state.batch_latency, 50) / 1e3,
+            histogram_percentile(state.batch_latency, 99) / 1e3, state.batch_latency.max_ns / 1e3);
+    report_phase_counters(stderr, &phase);
+
+    if (verify_results && !verify_ingest(state.dset_id, record_type, options)) {
+      result = false;
+    }
+
+    assert(H5Dclose(state.dset_id) >= 0);
+    assert(H5Pclose(dcpl) >= 0);
+    assert(H5Sclose(dspace) >= 0);
+    assert(H5Fclose(file_id) >= 0);
+    assert(remove(options.file_name) == 0);
+  }
+  g_phase_step.clear();
+  assert(H5Tclose(record_type) >= 0);
+
+  return result;
+}
+
+// NOTE(chogan): Parses a comma separated list of sizes like "1024,16384"
+static bool parse_size_list(const char *str, std::vector<hsize_t> *result) {
+  result->clear();
+  const char *p = str;
+  while (*p) {
+    char *end = 0;
+    unsigned long long value = strtoull(p, &end, 10);
+    if (end == p || value == 0) {
+      return false;
+    }
+    result->push_back((hsize_t)value);
+    p = *end == ',' ? end + 1 : end;
+    if (*end && *end != ',') {
+      return false;
+    }
+  }
+
+  return !result->empty();
+}
+
+//
+// Striping
+//
+
+// NOTE(chogan): Every thread in the normal modes goes through one file id, and
+// so one H5F_shared_t and one H5FD_t. These layouts spread the same logical
+// dataset (dset_size elements, one contiguous slice per thread) over several
+// physical files to see whether file level sharding gets around the shared
+// driver:
+//   single:     one file, the baseline
+//   family:     one file id over family driver members of --stripe-member-size
+//   per-thread: thread i writes and reads slice i in its own file
+//   virtual:    the per-thread files joined by a virtual dataset, read through
+//               one file id
+enum class StripeLayout {
+  kSingle,
+  kFamily,
+  kPerThread,
+  kVirtual,
+};
+
+struct StripeOptions {
+  const char *base_name;
+  hsize_t family_member_bytes;
+  int num_threads;
+};
+
+const char *stripe_phase_names[][2] = {
+  {"single write", "single read"},
+  {"family write", "family read"},
+  {"per-thread write", "per-thread read"},
+  {"virtual write", "virtual read"},
+};
+
+static std::string stripe_file_name(const char *base_name, StripeLayout layout, int index) {
+  char result[4096];
+  switch (layout) {
+    case StripeLayout::kSingle: {
+      snprintf(result, sizeof(result), "%s.h5", base_name);
+      break;
+    }
+    case StripeLayout::kFamily: {
+      // NOTE(chogan): The family driver substitutes the member number for %d
+      snprintf(result, sizeof(result), "%s-family-%%d.h5", base_name);
+      break;
+    }
+    case StripeLayout::kPerThread: {
+      snprintf(result, sizeof(result), "%s-part-%d.h5", base_name, index);
+      break;
+    }
+    case StripeLayout::kVirtual: {
+      snprintf(result, sizeof(result), "%s-virtual.h5", base_name);
+      break;
+    }
+  }
+
+  return result;
+}
+
+static hid_t stripe_fapl(const StripeOptions &options, StripeLayout layout) {
+  hid_t result = H5Pcreate(H5P_FILE_ACCESS);
+  assert(result >= 0);
+  if (layout == StripeLayout::kFamily) {
+    assert(H5Pset_fapl_family(result, options.family_member_bytes, H5P_DEFAULT) >= 0);
+  }
+
+  return result;
+}
+
+// NOTE(chogan): Where thread i's slice lives: a dataset handle and the offset
+// of the slice within that dataset.
+struct StripeSlice {
+  hid_t dset_id;
+  hsize_t file_offset;
+};
+
+static void stripe_io(Phase *phase, const std::vector<StripeSlice> &slices, hsize_t count,
+                      u64 *buf, bool write) {
+  auto io_func = [write](StripeSlice slice, hsize_t count, u64 *buf) {
+    const hsize_t stride = 1;
+    const hsize_t block = 1;
+    hid_t mspace = H5Screate_simple(1, &count, NULL);
+    assert(mspace >= 0);
+    hid_t fspace = H5Dget_space(slice.dset_id);
+    assert(fspace >= 0);
+    assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &slice.file_offset, &stride, &count,
+                               &block) >= 0);
+    if (write) {
+      assert(TRACE_CALL("H5Dwrite", H5Dwrite(slice.dset_id, H5T_NATIVE_UINT64, mspace, fspace,
+                                             H5P_DEFAULT, buf)) >= 0);
+    } else {
+      assert(TRACE_CALL("H5Dread", H5Dread(slice.dset_id, H5T_NATIVE_UINT64, mspace, fspace,
+                                           H5P_DEFAULT, buf)) >= 0);
+    }
+    assert(H5Sclose(fspace) >= 0);
+    assert(H5Sclose(mspace) >= 0);
+  };
+
+  std::vector<std::thread> threads;
+  start_phase(phase);
+  for (size_t i = 0; i < slices.size(); ++i) {
+    threads.push_back(spawn_worker(phase, i, io_func, slices[i], count, buf + i * count));
+  }
+  join_workers(threads);
+  end_phase(phase);
+}
+
+// NOTE(chogan): `single_seconds` is the time of the same phase in the single
+// file layout, or 0 when reporting the single file layout itself.
+static void report_stripe_phase(const Phase &phase, double single_seconds) {
+  fprintf(stderr, "Total seconds for %s of %llu bytes with %d threads: %f (%f GB/s", phase.name,
+          (unsigned long long)phase.bytes, phase.num_threads, phase.seconds,
+          phase.bytes / phase.seconds / (1024.0 * 1024.0 * 1024.0));
+  if (single_seconds > 0) {
+    fprintf(stderr, ", %.2fx single file", single_seconds / phase.seconds);
+  }
+  fprintf(stderr, ")\n");
+  report_phase_counters(stderr, &phase);
+}
+
+// NOTE(chogan): Creates the files for `layout` and opens one dataset handle
+// per thread. Returns the file ids to close.
+static std::vector<hid_t> open_stripe_layout(const StripeOptions &options, StripeLayout layout,
+                                             bool create, std::vector<StripeSlice> *slices) {
+  const hsize_t count = dset_size / options.num_threads;
+  const hsize_t total = count * options.num_threads;
+  std::vector<hid_t> file_ids;
+  slices->clear();
+
+  if (layout == StripeLayout::kPerThread) {
+    for (int i = 0; i < options.num_threads; ++i) {
+      std::string name = stripe_file_name(options.base_name, layout, i);
+      hid_t file_id = (create ? H5Fcreate(name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT)
+                              : H5Fopen(name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT));
+      assert(file_id >= 0);
+      hid_t dset_id = -1;
+      if (create) {
+        hid_t dspace = H5Screate_simple(1, &count, NULL);
+        assert(dspace >= 0);
+        dset_id = H5Dcreate(file_id, "a", H5T_NATIVE_UINT64, dspace, H5P_DEFAULT, H5P_DEFAULT,
+                            H5P_DEFAULT);
+        assert(H5Sclose(dspace) >= 0);
+      } else {
+        dset_id = H5Dopen(file_id, "a", H5P_DEFAULT);
+      }
+      assert(dset_id >= 0);
+      file_ids.push_back(file_id);
+      slices->push_back({dset_id, 0});
+    }
+    return file_ids;
+  }
+
+  hid_t fapl = stripe_fapl(options, layout);
+  std::string name = stripe_file_name(options.base_name, layout, 0);
+  hid_t file_id = -1;
+  if (create) {
+    file_id = H5Fcreate(name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+    assert(file_id >= 0);
+    hid_t dspace = H5Screate_simple(1, &total, NULL);
+    assert(dspace >= 0);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    assert(dcpl >= 0);
+    if (layout == StripeLayout::kVirtual) {
+      const hsize_t stride = 1;
+      const hsize_t block = 1;
+      hid_t src_space = H5Screate_simple(1, &count, NULL);
+      assert(src_space >= 0);
+      for (int i = 0; i < options.num_threads; ++i) {
+        hsize_t offset = i * count;
+        assert(H5Sselect_hyperslab(dspace, H5S_SELECT_SET, &offset, &stride, &count, &block) >= 0);
+        std::string part = stripe_file_name(options.base_name, StripeLayout::kPerThread, i);
+        assert(H5Pset_virtual(dcpl, dspace, part.c_str(), "a", src_space) >= 0);
+      }
+      assert(H5Sselect_all(dspace) >= 0);
+      assert(H5Sclose(src_space) >= 0);
+    }
+    hid_t dset_id = H5Dcreate(file_id, "a", H5T_NATIVE_UINT64, dspace, H5P_DEFAULT, dcpl,
+                              H5P_DEFAULT);
+    assert(dset_id >= 0);
+    assert(H5Dclose(dset_id) >= 0);
+    assert(H5Pclose(dcpl) >= 0);
+    assert(H5Sclose(dspace) >= 0);
+  } else {
+    file_id = H5Fopen(name.c_str(), H5F_ACC_RDONLY, fapl);
+    assert(file_id >= 0);
+  }
+  assert(H5Pclose(fapl) >= 0);
+
+  // NOTE(chogan): One dataset handle per thread, like read_datasets
+  for (int i = 0; i < options.num_threads; ++i) {
+    hid_t dset_id = H5Dopen(file_id, "a", H5P_DEFAULT);
+    assert(dset_id >= 0);
+    slices->push_back({dset_id, i * count});
+  }
+  file_ids.push_back(file_id);
+
+  return file_ids;
+}
+
+static void close_stripe_layout(const std::vector<hid_t> &file_ids,
+                                const std::vector<StripeSlice> &slices) {
+  for (const StripeSlice &slice : slices) {
+    assert(H5Dclose(slice.dset_id) >= 0);
+  }
+  for (hid_t file_id : file_ids) {
+    assert(H5Fclose(file_id) >= 0);
+  }
+}
+
+static void remove_stripe_files(const StripeOptions &options) {
+  remove(stripe_file_name(options.base_name, StripeLayout::kSingle, 0).c_str());
+  remove(stripe_file_name(options.base_name, StripeLayout::kVirtual, 0).c_str());
+  for (int i = 0; i < options.num_threads; ++i) {
+    remove(stripe_file_name(options.base_name, StripeLayout::kPerThread, i).c_str());
+  }
+  std::string family = stripe_file_name(options.base_name, StripeLayout::kFamily, 0);
+  for (int i = 0; ; ++i) {
+    char member[4096];
+    snprintf(member, sizeof(member), family.c_str(), i);
+    if (remove(member) != 0) {
+      break;
+    }
+  }
+}
+
+bool run_stripe(const StripeOptions &options, bool verify_results) {
+  assert(dset_size % options.num_threads == 0);
+  const hsize_t count = dset_size / options.num_threads;
+  const uint64_t total_bytes = (uint64_t)dset_size * sizeof(u64);
+  std::vector<u64> data(dset_size);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i;
+  }
+  std::vector<u64> dest(dset_size);
+  u64 *destinations[] = {dest.data()};
+  bool result = true;
+  double single_write_seconds = 0;
+  double single_read_seconds = 0;
+
+  fprintf(stderr, "Stripe: %d threads, family member size %llu bytes\n", options.num_threads,
+          (unsigned long long)options.family_member_bytes);
+
+  const StripeLayout layouts[] = {StripeLayout::kSingle, StripeLayout::kFamily,
+                                  StripeLayout::kPerThread, StripeLayout::kVirtual};
+  for (StripeLayout layout : layouts) {
+    std::vector<StripeSlice> slices;
+    std::vector<hid_t> file_ids;
+    const char **names = stripe_phase_names[(int)layout];
+
+    // NOTE(chogan): The virtual dataset maps the per-thread files written by
+    // the previous layout, so it only has a read phase.
+    file_ids = open_stripe_layout(options, layout, true, &slices);
+    if (layout != StripeLayout::kVirtual) {
+      Phase write_phase(names[0], true, options.num_threads, options.num_threads, total_bytes);
+      stripe_io(&write_phase, slices, count, data.data(), true);
+      report_stripe_phase(write_phase, single_write_seconds);
+      if (layout == StripeLayout::kSingle) {
+        single_write_seconds = write_phase.seconds;
+      }
+    }
+    close_stripe_layout(file_ids, slices);
+
+    memset(dest.data(), 0, dest.size() * sizeof(u64));
+    file_ids = open_stripe_layout(options, layout, false, &slices);
+    Phase read_phase(names[1], true, options.num_threads, options.num_threads, total_bytes);
+    stripe_io(&read_phase, slices, count, dest.data(), false);
+    report_stripe_phase(read_phase, single_read_seconds);
+    if (layout == StripeLayout::kSingle) {
+      single_read_seconds = read_phase.seconds;
+    }
+    close_stripe_layout(file_ids, slices);
+
+    if (verify_results && !verify_datasets(1, dset_size, destinations)) {
+      fprintf(stderr, "Verification of the %s layout failed\n", names[1]);
+      result = false;
+    }
+  }
+  remove_stripe_files(options);
+
+  return result;
+}
+
+//
+// Selection patterns
+//
+
+// NOTE(chogan): The normal reads use H5S_ALL or one contiguous hyperslab, so
+// the selection iterator (H5S_select_iter_init, H5S_select_iter_get_seq_list)
+// only ever produces one sequence per call. These patterns read a cube of side
+// `side` (element value == linear offset) with selections that make the
+// iterator produce many short sequences. Each thread reads the same pattern
+// over its own slab of planes along dimension 0. A sequence here is one
+// contiguous run in the file (or, when the memory selection is also
+// non-contiguous, in whichever side is more fragmented), counted from how the
+// selection was built since 1.10 has no public way to ask the iterator.
+enum class SelectionKind {
+  kStrided,
+  kBlockStrided,
+  kIrregular,
+  kPoints1K,
+  kPoints16K,
+  kPoints256K,
+  kMemoryStrided,
+  kCount,
+};
+
+const char *selection_names[] = {
+  "strided",
+  "block-strided",
+  "irregular union",
+  "points 1K",
+  "points 16K",
+  "points 256K",
+  "memory strided",
+};
+
+struct SelectionOptions {
+  const char *file_name;
+  hsize_t side;
+  int max_threads;
+};
+
+struct Selection {
+  hid_t file_space;
+  hid_t mem_space;
+  hsize_t mem_elements;
+  uint64_t elements;
+  uint64_t sequences;
+  // NOTE(chogan): Only for point selections, in selection order
+  std::vector<u64> offsets;
+};
+
+static u64 selection_random(u64 *state) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+
+  return *state >> 33;
+}
+
+// NOTE(chogan): The selection for the slab of `rows` planes starting at `row`
+static Selection build_selection(SelectionKind kind, hsize_t side, hsize_t row, hsize_t rows) {
+  const hsize_t dims[3] = {side, side, side};
+  const hsize_t ones[3] = {1, 1, 1};
+  Selection result = {};
+  result.file_space = H5Screate_simple(3, dims, NULL);
+  assert(result.file_space >= 0);
+
+  switch (kind) {
+    case SelectionKind::kStrided: {
+      // NOTE(chogan): Every other element along the fastest dimension
+      const hsize_t start[3] = {row, 0, 0};
+      const hsize_t stride[3] = {1, 1, 2};
+      const hsize_t count[3] = {rows, side, side / 2};
+      assert(H5Sselect_hyperslab(result.file_space, H5S_SELECT_SET, start, stride, count,
+                                 ones) >= 0);
+      result.elements = rows * side * (side / 2);
+      result.sequences = result.elements;
+      break;
+    }
+    case SelectionKind::kBlockStrided:
+    case SelectionKind::kMemoryStrided: {
+      // NOTE(chogan): Blocks of 4 elements every 8, on every other row
+      const hsize_t start[3] = {row, 0, 0};
+      const hsize_t stride[3] = {1, 2, 8};
+      const hsize_t count[3] = {rows, side / 2, side / 8};
+      const hsize_t block[3] = {1, 1, 4};
+      assert(H5Sselect_hyperslab(result.file_space, H5S_SELECT_SET, start, stride, count,
+                                 block) >= 0);
+      result.elements = rows * (side / 2) * (side / 8) * 4;
+      result.sequences = rows * (side / 2) * (side / 8);
+      break;
+    }
+    case SelectionKind::kIrregular: {
+      // NOTE(chogan): A union of differently sized boxes, one per cell of a
+      // 32x32 grid over dimensions 1 and 2. Boxes are narrower than a cell so
+      // no two boxes merge into one run.
+      const hsize_t cells = 32;
+      const hsize_t cell = side / cells;
+      assert(cell >= 2);
+      bool first = true;
+      for (hsize_t i = 0; i < cells; ++i) {
+        for (hsize_t j = 0; j < cells; ++j) {
+          hsize_t k = i * cells + j;
+          const hsize_t start[3] = {row, i * cell, j * cell};
+          const hsize_t count[3] = {rows, 1 + (k * 3) % cell, 1 + (k * 5 + i) % (cell - 1)};
+          assert(H5Sselect_hyperslab(result.file_space, first ? H5S_SELECT_SET : H5S_SELECT_OR,
+                                     start, ones, count, ones) >= 0);
+          first = false;
+          result.elements += count[0] * count[1] * count[2];
+          result.sequences += count[0] * count[1];
+        }
+      }
+      break;
+    }
+    case SelectionKind::kPoints1K:
+    case SelectionKind::kPoints16K:
+    case SelectionKind::kPoints256K: {
+      size_t num_points = (kind == SelectionKind::kPoints1K ? 1024 :
+                           kind == SelectionKind::kPoints16K ? 16 * 1024 : 256 * 1024);
+      std::vector<hsize_t> coords(num_points * 3);
+      u64 state = row + 1;
+      for (size_t i = 0; i < num_points; ++i) {
+        hsize_t *coord = &coords[i * 3];
+        coord[0] = row + selection_random(&state) % rows;
+        coord[1] = selection_random(&state) % side;
+        coord[2] = selection_random(&state) % side;
+        u64 offset = (coord[0] * side + coord[1]) * side + coord[2];
+        // NOTE(chogan): Points are visited in the order given, so only
+        // consecutive points at adjacent offsets share a sequence
+        if (i == 0 || offset != result.offsets.back() + 1) {
+          result.sequences++;
+        }
+        result.offsets.push_back(offset);
+      }
+      assert(H5Sselect_elements(result.file_space, H5S_SELECT_SET, num_points,
+                                coords.data()) >= 0);
+      result.elements = num_points;
+      break;
+    }
+    case SelectionKind::kCount: {
+      assert(!"Invalid SelectionKind");
+      break;
+    }
+  }
+
+  if (kind == SelectionKind::kMemoryStrided) {
+    // NOTE(chogan): Scatter into blocks of 2 elements every 3 in memory, so
+    // every 4 element file run is split in two
+    result.mem_elements = result.elements / 2 * 3;
+    result.mem_space = H5Screate_simple(1, &result.mem_elements, NULL);
+    assert(result.mem_space >= 0);
+    const hsize_t start = 0;
+    const hsize_t stride = 3;
+    const hsize_t count = result.elements / 2;
+    const hsize_t block = 2;
+    assert(H5Sselect_hyperslab(result.mem_space, H5S_SELECT_SET, &start, &stride, &count,
+                               &block) >= 0);
+    result.sequences = count;
+  } else {
+    result.mem_elements = result.elements;
+    result.mem_space = H5Screate_simple(1, &result.mem_elements, NULL);
+    assert(result.mem_space >= 0);
+  }
+
+  return result;
+}
+
+// NOTE(chogan): Hyperslab selections are read in file order, so the values
+// (linear offsets) must be strictly increasing and inside the slab. Point
+// selections must match the points exactly.
+static bool verify_selection(SelectionKind kind, const Selection &selection, const u64 *buf,
+                             hsize_t side, hsize_t row, hsize_t rows) {
+  const u64 first = row * side * side;
+  const u64 end = (row + rows) * side * side;
+  u64 previous = 0;
+  uint64_t seen = 0;
+  for (hsize_t i = 0; i < selection.mem_elements; ++i) {
+    if (kind == SelectionKind::kMemoryStrided && i % 3 == 2) {
+      if (buf[i] != UINT64_MAX) {
+        return false;
+      }
+      continue;
+    }
+    if (!selection.offsets.empty()) {
+      if (buf[i] != selection.offsets[i]) {
+        return false;
+      }
+    } else if (buf[i] < first || buf[i] >= end || (seen > 0 && buf[i] <= previous)) {
+      return false;
+    }
+    previous = buf[i];
+    seen++;
+  }
+
+  return seen == selection.elements;
+}
+
+static void create_selection_file(const SelectionOptions &options) {
+  const hsize_t side = options.side;
+  const hsize_t dims[3] = {side, side, side};
+  hid_t file_id = H5Fcreate(options.file_name, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  assert(file_id >= 0);
+  hid_t dspace = H5Screate_simple(3, dims, NULL);
+  assert(dspace >= 0);
+  hid_t dset_id = H5Dcreate(file_id, "a", H5T_NATIVE_UINT64, dspace, H5P_DEFAULT, H5P_DEFAULT,
+                            H5P_DEFAULT);
+  assert(dset_id >= 0);
+
+  // NOTE(chogan): One plane at a time so the whole cube never has to be in memory
+  const hsize_t plane_dims[3] = {1, side, side};
+  std::vector<u64> plane(side * side);
+  hid_t mspace = H5Screate_simple(3, plane_dims, NULL);
+  assert(mspace >= 0);
+  for (hsize_t i = 0; i < side; ++i) {
+    for (hsize_t j = 0; j < plane.size(); ++j) {
+      plane[j] = i * side * side + j;
+    }
+    const hsize_t start[3] = {i, 0, 0};
+    assert(H5Sselect_hyperslab(dspace, H5S_SELECT_SET, start, NULL, plane_dims, NULL) >= 0);
+    assert(H5Dwrite(dset_id, H5T_NATIVE_UINT64, mspace, dspace, H5P_DEFAULT, plane.data()) >= 0);
+  }
+
+  assert(H5Sclose(mspace) >= 0);
+  assert(H5Dclose(dset_id) >= 0);
+  assert(H5Sclose(dspace) >= 0);
+  assert(H5Fclose(file_id) >= 0);
+}
+
+bool run_selections(const SelectionOptions &options, bool verify_results) {
+  assert(options.side >= 64 && options.side % 8 == 0);
+  assert(options.max_threads >= 1 && (hsize_t)options.max_threads <= options.side);
+  const hsize_t side = options.side;
+  bool result = true;
+
+  fprintf(stderr, "Selections: %llu^3 cube of u64, up to %d threads\n", (unsigned long long)side,
+          options.max_threads);
+  create_selection_file(options);
+  hid_t file_id = H5Fopen(options.file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+  assert(file_id >= 0);
+
+  for (int kind_index = 0; kind_index < (int)SelectionKind::kCount; ++kind_index) {
+    SelectionKind kind = (SelectionKind)kind_index;
+    for (int num_threads = 1; ; num_threads *= 2) {
+      num_threads = std::min(num_threads, options.max_threads);
+      g_phase_step = std::to_string(num_threads) + " threads";
+
+      // NOTE(chogan): Selections and buffers are set up outside the phase so
+      // only the reads (and the iteration inside them) are timed
+      std::vector<Selection> selections;
+      std::vector<std::vector<u64>> buffers(num_threads);
+      std::vector<hid_t> dset_ids;
+      uint64_t elements = 0;
+      uint64_t sequences = 0;
+      for (int i = 0; i < num_threads; ++i) {
+        hsize_t row = i * side / num_threads;
+        hsize_t rows = (i + 1) * side / num_threads - row;
+        selections.push_back(build_selection(kind, side, row, rows));
+        buffers[i].assign(selections[i].mem_elements, UINT64_MAX);
+        elements += selections[i].elements;
+        sequences += selections[i].sequences;
+        hid_t dset_id = H5Dopen(file_id, "a", H5P_DEFAULT);
+        assert(dset_id >= 0);
+        dset_ids.push_back(dset_id);
+      }
+
+      auto read_func = [](hid_t dset_id, hid_t mem_space, hid_t file_space, u64 *buf) {
+        assert(TRACE_CALL("H5Dread", H5Dread(dset_id, H5T_NATIVE_UINT64, mem_space, file_space,
+                                             H5P_DEFAULT, buf)) >= 0);
+      };
+
+      Phase phase(selection_names[kind_index], true, num_threads, num_threads,
+                  elements * sizeof(u64));
+      std::vector<std::thread> threads;
+      start_phase(&phase);
+      for (int i = 0; i < num_threads; ++i) {
+        threads.push_back(spawn_worker(&phase, i, read_func, dset_ids[i], selections[i].mem_space,
+                                       selections[i].file_space, buffers[i].data()));
+      }
+      join_workers(threads);
+      end_phase(&phase);
+
+      fprintf(stderr, "Selection %s with %d threads: %f seconds, %llu sequences, "
+              "%f sequences/sec, %f bytes/sequence, %f MB/s\n", phase.name, num_threads,
+              phase.seconds, (unsigned long long)sequences, sequences / phase.seconds,
+              (double)phase.bytes / (double)sequences,
+              phase.bytes / phase.seconds / (1024.0 * 1024.0));
+      report_phase_counters(stderr, &phase);
+
+      for (int i = 0; i < num_threads; ++i) {
+        hsize_t row = i * side / num_threads;
+        hsize_t rows = (i + 1) * side / num_threads - row;
+        if (verify_results &&
+            !verify_selection(kind, selections[i], buffers[i].data(), side, row, rows)) {
+          fprintf(stderr, "Verification of selection %s failed on thread %d\n", phase.name, i);
+          result = false;
+        }
+        assert(H5Sclose(selections[i].mem_space) >= 0);
+        assert(H5Sclose(selections[i].file_space) >= 0);
+        assert(H5Dclose(dset_ids[i]) >= 0);
+      }
+
+      if (num_threads == options.max_threads) {
+        break;
+      }
+    }
+  }
+
+  g_phase_step.clear();
+  assert(H5Fclose(file_id) >= 0);
+  remove(options.file_name);
+
+  return result;
+}
+
+//
+// Autotune
+//
+
+// NOTE(chogan): Searches the read settings with successive halving. Every
+// candidate gets a short probe that reads a budget of bytes spread over the
+// threads the same way the normal read does (one dataset per thread, or one
+// slice of a single dataset per thread). The better half survives to the next
+// round, which doubles the budget. The search stops early once the best
+// candidate is no longer ahead of the median survivor by more than the noise,
+// measured by probing the best candidate twice. Only thread counts the normal
+// run accepts for `num_dsets` are searched, so the result can be loaded with
+// --tuned.
+struct TuneConfig {
+  int num_threads;
+  hsize_t request_elems;
+  size_t sieve_bytes;
+  size_t page_buffer_bytes;
+  AffinityPolicy affinity;
+  double gbps;
+};
+
+struct TuneOptions {
+  const char *output_file_name;
+  uint64_t initial_probe_bytes;
+  int max_threads;
+  double tolerance;
+};
+
+static void apply_tune_config(const TuneConfig &config) {
+  g_request_elems = config.request_elems;
+  g_sieve_bytes = config.sieve_bytes;
+  g_page_buffer_bytes = config.page_buffer_bytes;
+  g_affinity.policy = config.affinity;
+  init_affinity(&g_affinity);
+}
+
+// NOTE(chogan): 0 means the default for every setting
+static void print_tune_config(FILE *out, const TuneConfig &config) {
+  fprintf(out, "threads %d, request %llu elements, sieve %zu bytes, page buffer %zu bytes, "
+          "affinity %s", config.num_threads, (unsigned long long)config.request_elems,
+          config.sieve_bytes, config.page_buffer_bytes, affinity_policy_name(config.affinity));
+}
+
+// NOTE(chogan): The page buffer can only be used on files created with the
+// paged file space strategy
+static bool file_uses_paging(const char *file_name) {
+  hid_t file_id = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+  assert(file_id >= 0);
+  hid_t fcpl = H5Fget_create_plist(file_id);
+  assert(fcpl >= 0);
+  H5F_fspace_strategy_t strategy;
+  hbool_t persist;
+  hsize_t threshold;
+  assert(H5Pget_file_space_strategy(fcpl, &strategy, &persist, &threshold) >= 0);
+  assert(H5Pclose(fcpl) >= 0);
+  assert(H5Fclose(file_id) >= 0);
+
+  return strategy == H5F_FSPACE_STRATEGY_PAGE;
+}
+
+// NOTE(chogan): Returns GB/s. `probe_index` rotates where in its region each
+// thread's probe starts, so consecutive probes don't all read the same prefix.
+static double run_tune_probe(const char *file_name, const char **dset_names, int num_dsets,
+                             const TuneConfig &config, uint64_t probe_bytes, u64 **dests,
+                             int probe_index) {
+  apply_tune_config(config);
+  hid_t fapl = create_read_fapl();
+  hid_t file_id = H5Fopen(file_name, H5F_ACC_RDONLY, fapl);
+  assert(file_id >= 0);
+  assert(H5Pclose(fapl) >= 0);
+
+  // NOTE(chogan): Each thread's share of the probe is a piece of the region it
+  // reads in the normal run
+  const int num_threads = config.num_threads;
+  const bool split = num_dsets == 1;
+  const hsize_t region_elems = split ? dset_size / num_threads : dset_size;
+  const int regions_per_thread = (num_threads == 1 && !split) ? num_dsets : 1;
+  const hsize_t probe_elems = std::max<hsize_t>(
+      std::min<hsize_t>(probe_bytes / sizeof(u64) / (num_threads * regions_per_thread),
+                        region_elems), 1);
+  const hsize_t probe_start = (probe_index * probe_elems) % (region_elems - probe_elems + 1);
+
+  std::vector<hid_t> dset_ids;
+  for (int i = 0; i < num_threads * regions_per_thread; ++i) {
+    hid_t dset_id = H5Dopen(file_id, dset_names[split ? 0 : i], H5P_DEFAULT);
+    assert(dset_id >= 0);
+    dset_ids.push_back(dset_id);
+  }
+
+  auto probe_func = [&dset_ids, regions_per_thread, probe_elems, probe_start, split, region_elems,
+                     dests](int thread) {
+    for (int region = 0; region < regions_per_thread; ++region) {
+      int index = thread * regions_per_thread + region;
+      hsize_t offset = (split ? thread * region_elems : 0) + probe_start;
+      u64 *dest = split ? dests[0] + offset : dests[index] + offset;
+      if (g_request_elems) {
+        read_in_requests(dset_ids[index], offset, probe_elems, dest);
+      } else {
+        hid_t fspace = H5Dget_space(dset_ids[index]);
+        assert(fspace >= 0);
+        hid_t mspace = H5Screate_simple(1, &probe_elems, NULL);
+        assert(mspace >= 0);
+        assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &probe_elems,
+                                   NULL) >= 0);
+        assert(TRACE_CALL("H5Dread", H5Dread(dset_ids[index], H5T_STD_I64LE, mspace, fspace,
+                                             H5P_DEFAULT, dest)) >= 0);
+        assert(H5Sclose(mspace) >= 0);
+        assert(H5Sclose(fspace) >= 0);
+      }
+    }
+  };
+
+  const uint64_t bytes = (uint64_t)probe_elems * sizeof(u64) * num_threads * regions_per_thread;
+  Phase phase("probe", true, num_threads, num_threads * regions_per_thread, bytes, false);
+  std::vector<std::thread> threads;
+  start_phase(&phase);
+  for (int i = 0; i < num_threads; ++i) {
+    threads.push_back(spawn_worker(&phase, i, probe_func, i));
+  }
+  join_workers(threads);
+  end_phase(&phase);
+
+  for (hid_t dset_id : dset_ids) {
+    assert(H5Dclose(dset_id) >= 0);
+  }
+  assert(H5Fclose(file_id) >= 0);
+
+  return bytes / phase.seconds / (1024.0 * 1024.0 * 1024.0);
+}
+
+static std::vector<TuneConfig> tune_candidates(const char *file_name, int num_dsets,
+                                               int max_threads) {
+  std::vector<int> thread_counts;
+  if (num_dsets == 1) {
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+      thread_counts.push_back(num_threads);
+    }
+  } else {
+    thread_counts.push_back(1);
+    if (num_dsets <= max_threads) {
+      thread_counts.push_back(num_dsets);
+    }
+  }
+  const hsize_t request_elems[] = {0, 16 * 1024, 128 * 1024, 1024 * 1024};
+  const size_t sieve_bytes[] = {0, 1024 * 1024, 8 * 1024 * 1024};
+  std::vector<size_t> page_buffer_bytes = {0};
+  if (file_uses_paging(file_name)) {
+    page_buffer_bytes.push_back(4 * 1024 * 1024);
+    page_buffer_bytes.push_back(64 * 1024 * 1024);
+  }
+  const AffinityPolicy policies[] = {AffinityPolicy::kNone, AffinityPolicy::kCompact,
+                                     AffinityPolicy::kScatter};
+
+  std::vector<TuneConfig> result;
+  for (int num_threads : thread_counts) {
+    for (hsize_t request : request_elems) {
+      for (size_t sieve : sieve_bytes) {
+        for (size_t page_buffer : page_buffer_bytes) {
+          for (AffinityPolicy policy : policies) {
+            if (num_threads == 1 && policy != AffinityPolicy::kNone) {
+              continue;
+            }
+            result.push_back({num_threads, request, sieve, page_buffer, policy, 0});
+          }
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+static bool save_tune_config(const char *file_name, const char *input_file_name, int num_dsets,
+                             const TuneConfig &config) {
+  Results results;
+  set_result(&results, "config.file", "%s", input_file_name);
+  set_result(&results, "config.dsets", "%d", num_dsets);
+  add_machine_results(&results);
+  set_result(&results, "tune.threads", "%d", config.num_threads);
+  set_result(&results, "tune.request_elems", "%llu", (unsigned long long)config.request_elems);
+  set_result(&results, "tune.sieve_bytes", "%zu", config.sieve_bytes);
+  set_result(&results, "tune.page_buffer_bytes", "%zu", config.page_buffer_bytes);
+  set_result(&results, "tune.affinity", "%s", affinity_policy_name(config.affinity));
+  set_result(&results, "tune.gbps", "%f", config.gbps);
+
+  return write_results(file_name, results);
+}
+
+// NOTE(chogan): Sets the thread count, affinity, and g_ read settings from a
+// file written by --autotune
+static bool load_tune_config(const char *file_name, int *num_threads) {
+  ResultMap results;
+  if (!read_results(file_name, &results)) {
+    return false;
+  }
+  const char *keys[] = {"tune.threads", "tune.request_elems", "tune.sieve_bytes",
+                        "tune.page_buffer_bytes", "tune.affinity"};
+  for (const char *key : keys) {
+    if (results.find(key) == results.end()) {
+      fprintf(stderr, "Tuned config %s is missing %s\n", file_name, key);
+      return false;
+    }
+  }
+  *num_threads = atoi(results["tune.threads"].c_str());
+  g_request_elems = strtoull(results["tune.request_elems"].c_str(), 0, 10);
+  g_sieve_bytes = strtoull(results["tune.sieve_bytes"].c_str(), 0, 10);
+  g_page_buffer_bytes = strtoull(results["tune.page_buffer_bytes"].c_str(), 0, 10);
+  if (!parse_affinity(results["tune.affinity"].c_str(), &g_affinity)) {
+    fprintf(stderr, "Invalid affinity policy in %s\n", file_name);
+    return false;
+  }
+  fprintf(stderr, "Loaded tuned config from %s (%s GB/s when tuned)\n", file_name,
+          results["tune.gbps"].c_str());
+
+  return true;
+}
+
+bool run_autotune(const TuneOptions &options, const char *file_name, const char **dset_names,
+                  int num_dsets) {
+  u64 *dests[max_dsets];
+  for (int i = 0; i < num_dsets; ++i) {
+    dests[i] = (u64 *)malloc(dset_size * sizeof(u64));
+    assert(dests[i]);
+  }
+
+  // NOTE(chogan): Every probe then reads from the same (cached) state
+  prime_datasets(file_name, dset_names, num_dsets, dests);
+
+  std::vector<TuneConfig> candidates = tune_candidates(file_name, num_dsets, options.max_threads);
+  const uint64_t max_probe_bytes = (uint64_t)num_dsets * dset_size * sizeof(u64);
+  uint64_t probe_bytes = std::min(options.initial_probe_bytes, max_probe_bytes);
+
+  fprintf(stderr, "Autotune: %zu candidates, %llu byte initial probes\n", candidates.size(),
+          (unsigned long long)probe_bytes);
+
+  int probe_index = 0;
+  for (int round = 0; ; ++round) {
+    for (TuneConfig &config : candidates) {
+      config.gbps = run_tune_probe(file_name, dset_names, num_dsets, config, probe_bytes, dests,
+                                   probe_index++);
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const TuneConfig &a, const TuneConfig &b) {
+      return a.gbps > b.gbps;
+    });
+
+    const TuneConfig &best = candidates[0];
+    double repeat = run_tune_probe(file_name, dset_names, num_dsets, best, probe_bytes, dests,
+                                   probe_index++);
+    double noise = std::max(fabs(best.gbps - repeat) / std::max(best.gbps, repeat),
+                            options.tolerance);
+    double gain = (best.gbps - candidates[candidates.size() / 2].gbps) / best.gbps;
+
+    fprintf(stderr, "Round %d: %zu candidates, %llu bytes per probe, best %f GB/s (", round,
+            candidates.size(), (unsigned long long)probe_bytes, best.gbps);
+    print_tune_config(stderr, best);
+    fprintf(stderr, "), %.1f%% ahead of the median, noise %.1f%%\n", 100 * gain, 100 * noise);
+
+    if (candidates.size() == 1 || gain < noise) {
+      break;
+    }
+    candidates.resize((candidates.size() + 1) / 2);
+    probe_bytes = std::min(probe_bytes * 2, max_probe_bytes);
+  }
+
+  const TuneConfig &best = candidates[0];
+  fprintf(stderr, "Best config: ");
+  print_tune_config(stderr, best);
+  fprintf(stderr, " at %f GB/s\n", best.gbps);
+  for (int i = 0; i < num_dsets; ++i) {
+    free(dests[i]);
+  }
+
+  return save_tune_config(options.output_file_name, file_name, num_dsets, best);
+}
+
+//
+// File handles
+//
+
+// NOTE(chogan): The normal read shares one file id between all threads. Even
+// if every thread opened the file itself, the library would find it already
+// open and hand back the same H5F_shared_t and H5FD_t. These modes run the
+// same open, read, and close phases three ways to separate file level
+// contention from dataset level contention:
+//   shared:      the main thread opens the file once (the normal read)
+//   reopen:      every worker calls H5Fopen itself, which the library dedups
+//   independent: every worker calls H5Fopen through the nodedup driver
+//                (vfd.h), so each has its own shared file state and descriptor
+enum class HandleMode {
+  kShared,
+  kReopen,
+  kIndependent,
+  kCount,
+};
+
+const char *handle_mode_names[] = {"shared", "reopen", "independent"};
+const char *handle_phase_names[][3] = {
+  {"shared open", "shared read", "shared close"},
+  {"reopen open", "reopen read", "reopen close"},
+  {"independent open", "independent read", "independent close"},
+};
+
+bool run_handle_comparison(const char *file_name, const char **dset_names, int num_dsets,
+                           int num_threads, bool verify_results) {
+  assert(num_threads == num_dsets || num_dsets == 1);
+  assert(dset_size % num_threads == 0);
+  const bool split = num_dsets == 1;
+  const hsize_t count = split ? dset_size / num_threads : dset_size;
+  const uint64_t total_bytes = (uint64_t)num_dsets * dset_size * sizeof(u64);
+  u64 *dests[max_dsets];
+  for (int i = 0; i < num_dsets; ++i) {
+    dests[i] = (u64 *)malloc(dset_size * sizeof(u64));
+    assert(dests[i]);
+  }
+
+  prime_datasets(file_name, dset_names, num_dsets, dests);
+
+  double seconds[(int)HandleMode::kCount][3] = {};
+  bool result = true;
+  for (int mode_index = 0; mode_index < (int)HandleMode::kCount; ++mode_index) {
+    HandleMode mode = (HandleMode)mode_index;
+    const char **names = handle_phase_names[mode_index];
+    hid_t fapl = mode == HandleMode::kIndependent ? create_nodedup_fapl() : H5Pcreate(H5P_FILE_ACCESS);
+    assert(fapl >= 0);
+    hid_t shared_file_id = -1;
+    std::vector<hid_t> file_ids(num_threads, -1);
+    std::vector<hid_t> dset_ids(num_threads, -1);
+
+    auto open_func = [&](int worker) {
+      file_ids[worker] = shared_file_id;
+      if (mode != HandleMode::kShared) {
+        file_ids[worker] = TRACE_CALL("H5Fopen", H5Fopen(file_name, H5F_ACC_RDONLY, fapl));
+        assert(file_ids[worker] >= 0);
+      }
+      dset_ids[worker] = TRACE_CALL("H5Dopen", H5Dopen(file_ids[worker],
+                                                       dset_names[split ? 0 : worker],
+                                                       H5P_DEFAULT));
+      assert(dset_ids[worker] >= 0);
+    };
+
+    auto read_func = [&](int worker) {
+      hsize_t offset = split ? worker * count : 0;
+      u64 *dest = split ? dests[0] + offset : dests[worker];
+      hid_t mspace = H5Screate_simple(1, &count, NULL);
+      assert(mspace >= 0);
+      hid_t fspace = H5Dget_space(dset_ids[worker]);
+      assert(fspace >= 0);
+      assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &count, NULL) >= 0);
+      assert(TRACE_CALL("H5Dread", H5Dread(dset_ids[worker], H5T_STD_I64LE, mspace, fspace,
+                                           H5P_DEFAULT, dest)) >= 0);
+      assert(H5Sclose(fspace) >= 0);
+      assert(H5Sclose(mspace) >= 0);
+    };
+
+    auto close_func = [&](int worker) {
+      assert(TRACE_CALL("H5Dclose", H5Dclose(dset_ids[worker])) >= 0);
+      if (mode != HandleMode::kShared) {
+        assert(TRACE_CALL("H5Fclose", H5Fclose(file_ids[worker])) >= 0);
+      }
+    };
+
+    for (int phase_index = 0; phase_index < 3; ++phase_index) {
+      Phase phase(names[phase_index], true, num_threads, num_threads,
+                  phase_index == 1 ? total_bytes : 0);
+      std::vector<std::thread> threads;
+      start_phase(&phase);
+      // NOTE(chogan): The one shared open and close are part of the phases
+      // so all three modes pay for every H5Fopen and H5Fclose they make
+      if (phase_index == 0 && mode == HandleMode::kShared) {
+        shared_file_id = TRACE_CALL("H5Fopen", H5Fopen(file_name, H5F_ACC_RDONLY, fapl));
+        assert(shared_file_id >= 0);
+      }
+      for (int i = 0; i < num_threads; ++i) {
+        switch (phase_index) {
+          case 0: threads.push_back(spawn_worker(&phase, i, open_func, i)); break;
+          case 1: threads.push_back(spawn_worker(&phase, i, read_func, i)); break;
+          case 2: threads.push_back(spawn_worker(&phase, i, close_func, i)); break;
+        }
+      }
+      join_workers(threads);
+      if (phase_index == 2 && mode == HandleMode::kShared) {
+        assert(TRACE_CALL("H5Fclose", H5Fclose(shared_file_id)) >= 0);
+      }
+      end_phase(&phase);
+
+      seconds[mode_index][phase_index] = phase.seconds;
+      fprintf(stderr, "Total seconds to %s %d datasets with %d threads: %f\n", phase.name,
+              num_dsets, num_threads, phase.seconds);
+      report_phase_counters(stderr, &phase);
+    }
+    assert(H5Pclose(fapl) >= 0);
+
+    if (verify_results && !verify_datasets(num_dsets, dset_size, dests)) {
+      fprintf(stderr, "Verification of %s handles failed\n", handle_mode_names[mode_index]);
+      result = false;
+    }
+  }
+
+  const char *phase_names[] = {"open", "read", "close"};
+  for (int phase_index = 0; phase_index < 3; ++phase_index) {
+    double shared = seconds[(int)HandleMode::kShared][phase_index];
+    fprintf(stderr, "%s with %d threads: shared %f, reopen %f (%+.1f%%), independent %f (%+.1f%%)\n",
+            phase_names[phase_index], num_threads, shared,
+            seconds[(int)HandleMode::kReopen][phase_index],
+            100.0 * (seconds[(int)HandleMode::kReopen][phase_index] - shared) / shared,
+            seconds[(int)HandleMode::kIndependent][phase_index],
+            100.0 * (seconds[(int)HandleMode::kIndependent][phase_index] - shared) / shared);
+  }
+
+  for (int i = 0; i < num_dsets; ++i) {
+    free(dests[i]);
+  }
+
+  return result;
+}
+
+// NOTE(chogan): Number of elements per H5Dwrite in the allocation sweep
+const hsize_t kAllocSweepRequestElems = 1024 * 1024;
+
+// NOTE(chogan): Writes one dataset into a new file with 1, 2, 4, ... max_threads
+// threads under the current g_alloc_options. Each thread writes its slice in
+// requests, and the first request of each thread is timed separately from the
+// rest, since that is where late and incremental allocation (and the fill
+// value) are paid for.
+bool run_alloc_sweep(const char *file_name, int max_threads, bool verify_results) {
+  const hsize_t request_elems = kAllocSweepRequestElems;
+  const uint64_t total_bytes = (uint64_t)dset_size * sizeof(u64);
+  u64 *data = (u64 *)malloc(dset_size * sizeof(u64));
+  assert(data);
+  for (size_t i = 0; i < (size_t)dset_size; ++i) {
+    data[i] = i;
+  }
+
+  bool result = true;
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    g_phase_step = std::to_string(num_threads) + " threads";
+    assert(dset_size % num_threads == 0);
+    const hsize_t count = dset_size / num_threads;
+
+    Phase create_phase("alloc create", false, 1, 2, 0);
+    start_phase(&create_phase);
+    hid_t file_id = create_write_file(file_name);
+    const hsize_t dims = dset_size;
+    hid_t dspace = H5Screate_simple(1, &dims, NULL);
+    assert(dspace >= 0);
+    hid_t dcpl = create_write_dcpl(dims);
+    hid_t dset_id = TRACE_CALL("H5Dcreate", H5Dcreate(file_id, "a", H5T_NATIVE_ULONG, dspace,
+                                                      H5P_DEFAULT, dcpl, H5P_DEFAULT));
+    assert(dset_id >= 0);
+    end_phase(&create_phase);
+    assert(H5Pclose(dcpl) >= 0);
+    assert(H5Sclose(dspace) >= 0);
+
+    if (g_alloc_options.preallocate) {
+      preallocate_file(file_id, {dset_id}, total_bytes, num_threads);
+    }
+
+    std::mutex histogram_mutex;
+    LatencyHistogram first_writes;
+    LatencyHistogram later_writes;
+    init_histogram(&first_writes);
+    init_histogram(&later_writes);
+
+    auto write_func = [&](int worker) {
+      LatencyHistogram first;
+      LatencyHistogram later;
+      init_histogram(&first);
+      init_histogram(&later);
+      hid_t fspace = H5Dget_space(dset_id);
+      assert(fspace >= 0);
+      for (hsize_t done = 0; done < count; done += request_elems) {
+        hsize_t offset = worker * count + done;
+        hsize_t elems = std::min(request_elems, count - done);
+        hid_t mspace = H5Screate_simple(1, &elems, NULL);
+        assert(mspace >= 0);
+        assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &elems, NULL) >= 0);
+        uint64_t start_ns = monotonic_ns();
+        assert(TRACE_CALL("H5Dwrite", H5Dwrite(dset_id, H5T_NATIVE_ULONG, mspace, fspace,
+                                               H5P_DEFAULT, data + offset)) >= 0);
+        record_latency(done == 0 ? &first : &later, monotonic_ns() - start_ns);
+        assert(H5Sclose(mspace) >= 0);
+      }
+      assert(H5Sclose(fspace) >= 0);
+
+      std::lock_guard<std::mutex> lock(histogram_mutex);
+      merge_histogram(&first_writes, first);
+      merge_histogram(&later_writes, later);
+    };
+
+    const uint64_t num_requests = (uint64_t)num_threads * ((count + request_elems - 1) / request_elems);
+    Phase phase("alloc write", true, num_threads, num_requests, total_bytes);
+    std::vector<std::thread> threads;
+    start_phase(&phase);
+    for (int i = 0; i < num_threads; ++i) {
+      threads.push_back(spawn_worker(&phase, i, write_func, i));
+    }
+    join_workers(threads);
+    end_phase(&phase);
+    report_phase_counters(stderr, &phase);
+
+    flush_and_close(file_id, {dset_id});
+
+    fprintf(stderr, "Allocation with %d threads: create %f s, first write mean %.1f us max %.1f us, "
+            "later writes mean %.1f us p99 %.1f us, %f GB/s\n", num_threads, create_phase.seconds,
+            histogram_mean(first_writes) / 1000.0, first_writes.max_ns / 1000.0,
+            histogram_mean(later_writes) / 1000.0, histogram_percentile(later_writes, 99) / 1000.0,
+            total_bytes / phase.seconds / (1024.0 * 1024.0 * 1024.0));
+
+    if (verify_results) {
+      u64 *dest = (u64 *)malloc(dset_size * sizeof(u64));
+      assert(dest);
+      hid_t verify_file_id = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+      assert(verify_file_id >= 0);
+      hid_t verify_dset_id = H5Dopen(verify_file_id, "a", H5P_DEFAULT);
+      assert(verify_dset_id >= 0);
+      assert(H5Dread(verify_dset_id, H5T_STD_I64LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, dest) >= 0);
+      assert(H5Dclose(verify_dset_id) >= 0);
+      assert(H5Fclose(verify_file_id) >= 0);
+      if (!verify_datasets(1, dset_size, &dest)) {
+        fprintf(stderr, "Verification with %d threads failed\n", num_threads);
+        result = false;
+      }
+      free(dest);
+    }
+    remove(file_name);
+  }
+  g_phase_step.clear();
+  free(data);
+
+  return result;
+}
+
+// NOTE(chogan): How --copy moves each dataset:
+//   raw:       contiguous, unfiltered sources go straight from the source
+//              extent to the destination's early allocated extent with
+//              copy_file_range (copy.h), never passing through the library
+//   chunk:     chunked sources copy each stored chunk with H5Dread_chunk and
+//              H5Dwrite_chunk, so filtered chunks aren't decoded and re-encoded
+//   hyperslab: anything else (or everything, with --copy-method stream) is
+//              read and written through a per-thread buffer in windows
+enum class CopyMethod {
+  kRaw,
+  kChunk,
+  kHyperslab,
+  kCount,
+};
+
+const char *copy_method_names[] = {"raw", "chunk", "hyperslab"};
+
+// NOTE(chogan): Rows per hyperslab window are chosen so a window holds about
+// this many elements
+const hsize_t kCopyWindowElems = 1024 * 1024;
+
+struct CopyOptions {
+  const char *src_file_name;
+  const char *dst_file_name;
+  int num_threads;
+  int num_trials;
+  bool stream_only;
+};
+
+// NOTE(chogan): One unit of work for a copy worker. Raw tasks are byte ranges
+// of the files, chunk tasks one stored chunk, and hyperslab tasks a range of
+// rows along the first dimension.
+struct CopyTask {
+  CopyMethod method;
+  int dset_index;
+  uint64_t src_offset;
+  uint64_t dst_offset;
+  uint64_t bytes;
+  std::vector<hsize_t> start;
+  hsize_t rows;
+  uint32_t filter_mask;
+};
+
+static CopyMethod choose_copy_method(hid_t dset_id, hid_t dcpl, bool stream_only) {
+  if (stream_only) {
+    return CopyMethod::kHyperslab;
+  }
+  H5D_layout_t layout = H5Pget_layout(dcpl);
+  if (layout == H5D_CHUNKED) {
+    return CopyMethod::kChunk;
+  }
+  if (layout == H5D_CONTIGUOUS && H5Pget_nfilters(dcpl) == 0 && H5Pget_external_count(dcpl) == 0 &&
+      H5Dget_offset(dset_id) != HADDR_UNDEF) {
+    return CopyMethod::kRaw;
+  }
+
+  return CopyMethod::kHyperslab;
+}
+
+// NOTE(chogan): Adds the tasks that copy `src_id` to `dst_id`
+static void add_copy_tasks(std::vector<CopyTask> *tasks, CopyMethod method, int dset_index,
+                           hid_t src_id, hid_t dst_id) {
+  hid_t space = H5Dget_space(src_id);
+  assert(space >= 0);
+  int rank = H5Sget_simple_extent_ndims(space);
+  assert(rank >= 0);
+  std::vector<hsize_t> dims(std::max(rank, 1), 1);
+  assert(H5Sget_simple_extent_dims(space, dims.data(), NULL) >= 0);
+
+  switch (method) {
+    case CopyMethod::kRaw: {
+      const uint64_t bytes = H5Dget_storage_size(src_id);
+      const uint64_t src_offset = H5Dget_offset(src_id);
+      const uint64_t dst_offset = H5Dget_offset(dst_id);
+      assert(dst_offset != HADDR_UNDEF && "Destination wasn't allocated early");
+      for (uint64_t offset = 0; offset < bytes; offset += kCopyExtentBytes) {
+        CopyTask task = {method, dset_index, src_offset + offset, dst_offset + offset,
+                         std::min(kCopyExtentBytes, bytes - offset), {}, 0, 0};
+        tasks->push_back(task);
+      }
+      break;
+    }
+    case CopyMethod::kChunk: {
+      hsize_t num_chunks = 0;
+      assert(H5Dget_num_chunks(src_id, space, &num_chunks) >= 0);
+      for (hsize_t i = 0; i < num_chunks; ++i) {
+        CopyTask task = {method, dset_index, 0, 0, 0, std::vector<hsize_t>(rank), 0, 0};
+        haddr_t addr = 0;
+        hsize_t size = 0;
+        assert(H5Dget_chunk_info(src_id, space, i, task.start.data(), &task.filter_mask, &addr,
+                                 &size) >= 0);
+        task.bytes = size;
+        tasks->push_back(task);
+      }
+      break;
+    }
+    case CopyMethod::kHyperslab: {
+      hsize_t row_elems = 1;
+      for (int i = 1; i < rank; ++i) {
+        row_elems *= dims[i];
+      }
+      const hsize_t window_rows = std::max((hsize_t)1, kCopyWindowElems / row_elems);
+      hid_t type = H5Dget_type(src_id);
+      assert(type >= 0);
+      const size_t row_bytes = row_elems * H5Tget_size(type);
+      assert(H5Tclose(type) >= 0);
+      for (hsize_t row = 0; row < dims[0]; row += window_rows) {
+        CopyTask task = {method, dset_index, 0, 0, 0, std::vector<hsize_t>(dims.size(), 0), 0, 0};
+        task.start[0] = row;
+        task.rows = std::min(window_rows, dims[0] - row);
+        task.bytes = task.rows * row_bytes;
+        tasks->push_back(task);
+      }
+      break;
+    }
+    default: {
+      assert(!"Unknown copy method");
+    }
+  }
+  assert(H5Sclose(space) >= 0);
+}
+
+static void copy_hyperslab(hid_t src_id, hid_t dst_id, const CopyTask &task,
+                           std::vector<char> *buf) {
+  hid_t file_type = H5Dget_type(src_id);
+  assert(file_type >= 0);
+  hid_t type = H5Tget_native_type(file_type, H5T_DIR_DEFAULT);
+  assert(type >= 0);
+  hid_t fspace = H5Dget_space(src_id);
+  assert(fspace >= 0);
+  const int rank = H5Sget_simple_extent_ndims(fspace);
+  // NOTE(chogan): task.bytes is in the file type's size
+  buf->resize(task.bytes / H5Tget_size(file_type) * H5Tget_size(type));
+
+  if (rank == 0) {
+    assert(TRACE_CALL("H5Dread", H5Dread(src_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                                         buf->data())) >= 0);
+    assert(TRACE_CALL("H5Dwrite", H5Dwrite(dst_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                                           buf->data())) >= 0);
+  } else {
+    std::vector<hsize_t> count(rank);
+    assert(H5Sget_simple_extent_dims(fspace, count.data(), NULL) >= 0);
+    count[0] = task.rows;
+    hid_t mspace = H5Screate_simple(rank, count.data(), NULL);
+    assert(mspace >= 0);
+    assert(H5Sselect_hyperslab(fspace, H5S_SELECT_SET, task.start.data(), NULL, count.data(),
+                               NULL) >= 0);
+    assert(TRACE_CALL("H5Dread", H5Dread(src_id, type, mspace, fspace, H5P_DEFAULT,
+                                         buf->data())) >= 0);
+    assert(TRACE_CALL("H5Dwrite", H5Dwrite(dst_id, type, mspace, fspace, H5P_DEFAULT,
+                                           buf->data())) >= 0);
+    assert(H5Sclose(mspace) >= 0);
+  }
+  assert(H5Sclose(fspace) >= 0);
+  assert(H5Tclose(type) >= 0);
+  assert(H5Tclose(file_type) >= 0);
+}
+
+// NOTE(chogan): Reads every dataset of both files back through the library
+// and compares them
+static bool verify_copy(const CopyOptions &options, const char **dset_names, int num_dsets) {
+  hid_t src_file_id = H5Fopen(options.src_file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+  assert(src_file_id >= 0);
+  hid_t dst_file_id = H5Fopen(options.dst_file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+  assert(dst_file_id >= 0);
+
+  bool result = true;
+  for (int i = 0; i < num_dsets; ++i) {
+    std::vector<char> data[2];
+    hid_t file_ids[2] = {src_file_id, dst_file_id};
+    for (int j = 0; j < 2; ++j) {
+      hid_t dset_id = H5Dopen(file_ids[j], dset_names[i], H5P_DEFAULT);
+      assert(dset_id >= 0);
+      hid_t file_type = H5Dget_type(dset_id);
+      assert(file_type >= 0);
+      hid_t type = H5Tget_native_type(file_type, H5T_DIR_DEFAULT);
+      assert(type >= 0);
+      hid_t space = H5Dget_space(dset_id);
+      assert(space >= 0);
+      data[j].resize(H5Sget_simple_extent_npoints(space) * H5Tget_size(type));
+      assert(H5Dread(dset_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data[j].data()) >= 0);
+      assert(H5Sclose(space) >= 0);
+      assert(H5Tclose(type) >= 0);
+      assert(H5Tclose(file_type) >= 0);
+      assert(H5Dclose(dset_id) >= 0);
+    }
+    if (data[0] != data[1]) {
+      fprintf(stderr, "Dataset %s differs from the source\n", dset_names[i]);
+      result = false;
+    }
+  }
+  assert(H5Fclose(dst_file_id) >= 0);
+  assert(H5Fclose(src_file_id) >= 0);
+
+  return result;
+}
+
+// NOTE(chogan): The byte ranges of the source file that hold the stored data
+// of datasets `dset_names`: the extent of each contiguous dataset and every
+// allocated chunk of each chunked one. Compact datasets are stored in their
+// object headers, so they have none.
+static std::vector<FileExtent> dataset_extents(const char *file_name, const char **dset_names,
+                                               int num_dsets) {
+  hid_t file_id = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+  assert(file_id >= 0);
+  std::vector<FileExtent> result;
+  for (int i = 0; i < num_dsets; ++i) {
+    hid_t dset_id = H5Dopen(file_id, dset_names[i], H5P_DEFAULT);
+    assert(dset_id >= 0);
+    hid_t dcpl = H5Dget_create_plist(dset_id);
+    assert(dcpl >= 0);
+    H5D_layout_t layout = H5Pget_layout(dcpl);
+    if (layout == H5D_CONTIGUOUS && H5Dget_offset(dset_id) != HADDR_UNDEF) {
+      result.push_back({H5Dget_offset(dset_id), H5Dget_storage_size(dset_id)});
+    } else if (layout == H5D_CHUNKED) {
+      hid_t space = H5Dget_space(dset_id);
+      assert(space >= 0);
+      int rank = H5Sget_simple_extent_ndims(space);
+      assert(rank > 0);
+      std::vector<hsize_t> start(rank);
+      hsize_t num_chunks = 0;
+      assert(H5Dget_num_chunks(dset_id, space, &num_chunks) >= 0);
+      for (hsize_t j = 0; j < num_chunks; ++j) {
+        unsigned filter_mask = 0;
+        haddr_t addr = 0;
+        hsize_t size = 0;
+        assert(H5Dget_chunk_info(dset_id, space, j, start.data(), &filter_mask, &addr,
+                                 &size) >= 0);
+        if (addr != HADDR_UNDEF) {
+          result.push_back({addr, size});
+        }
+      }
+      assert(H5Sclose(space) >= 0);
+    }
+    assert(H5Pclose(dcpl) >= 0);
+    assert(H5Dclose(dset_id) >= 0);
+  }
+  assert(H5Fclose(file_id) >= 0);
+
+  return result;
+}
+
+// NOTE(chogan): Copies the stored data of datasets `dset_names` to the same
+// offsets of a scratch file with copy_file_range, like `mt_posix_io -C` but
+// without the file's metadata or any datasets past num_dsets, and returns the
+// GB/s as the ceiling for the copy
+static double measure_copy_ceiling(const CopyOptions &options, const char **dset_names,
+                                   int num_dsets) {
+  std::vector<FileExtent> extents = dataset_extents(options.src_file_name, dset_names,
+                                                    num_dsets);
+  uint64_t bytes = 0;
+  uint64_t end = 0;
+  for (const FileExtent &extent : extents) {
+    bytes += extent.bytes;
+    end = std::max(end, extent.offset + extent.bytes);
+  }
+
+  std::string ceiling_file_name = std::string(options.dst_file_name) + ".ceiling";
+  int src_fd = open(options.src_file_name, O_RDONLY);
+  assert(src_fd >= 0);
+  int dst_fd = open(ceiling_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(dst_fd >= 0);
+  const off_t file_bytes = lseek(src_fd, 0, SEEK_END);
+  assert(file_bytes >= 0);
+  assert(ftruncate(dst_fd, end) == 0);
+
+  std::vector<FileExtent> pieces = split_file_extents(extents);
+  Phase phase("copy ceiling", true, options.num_threads, pieces.size(), bytes, false);
+  bool used_copy_file_range = copy_file_extents(&phase, src_fd, dst_fd, pieces);
+  assert(close(dst_fd) == 0);
+  assert(close(src_fd) == 0);
+  remove(ceiling_file_name.c_str());
+
+  const double result = bytes / phase.seconds / (1024.0 * 1024.0 * 1024.0);
+  fprintf(stderr, "Copy ceiling: %llu stored bytes of %d datasets (of the %lld byte file) with "
+          "%d threads in %f seconds, %f GB/s%s\n", (unsigned long long)bytes, num_dsets,
+          (long long)file_bytes, options.num_threads, phase.seconds, result,
+          used_copy_file_range ? "" : " (fell back to pread and pwrite)");
+  report_phase_counters(stderr, &phase);
+
+  return result;
+}
+
+// NOTE(chogan): Copies datasets `dset_names` from the source file into a new
+// destination file with the same types, shapes, and creation properties,
+// using the fastest method each dataset allows. The destination is created
+// with the -w allocation options (except that raw copies always allocate
+// early) and never writes fill values, since every byte is copied. Returns
+// GB/s.
+static double copy_datasets(const CopyOptions &options, const char **dset_names, int num_dsets) {
+  Phase open_phase("copy open", false, 1, 2 * num_dsets, 0);
+  start_phase(&open_phase);
+  hid_t src_file_id = TRACE_CALL("H5Fopen", H5Fopen(options.src_file_name, H5F_ACC_RDONLY,
+                                                    H5P_DEFAULT));
+  assert(src_file_id >= 0);
+  hid_t dst_file_id = create_write_file(options.dst_file_name);
+
+  std::vector<hid_t> src_ids;
+  std::vector<hid_t> dst_ids;
+  std::vector<CopyMethod> methods;
+  std::vector<CopyTask> tasks;
+  for (int i = 0; i < num_dsets; ++i) {
+    hid_t src_id = TRACE_CALL("H5Dopen", H5Dopen(src_file_id, dset_names[i], H5P_DEFAULT));
+    assert(src_id >= 0);
+    hid_t src_dcpl = H5Dget_create_plist(src_id);
+    assert(src_dcpl >= 0);
+    CopyMethod method = choose_copy_method(src_id, src_dcpl, options.stream_only);
+
+    hid_t dcpl = H5Pcopy(src_dcpl);
+    assert(dcpl >= 0);
+    if (method == CopyMethod::kRaw) {
+      assert(H5Pset_alloc_time(dcpl, H5D_ALLOC_TIME_EARLY) >= 0);
+    } else if (g_alloc_options.alloc_time != H5D_ALLOC_TIME_DEFAULT &&
+               H5Pget_layout(dcpl) != H5D_COMPACT) {
+      assert(H5Pset_alloc_time(dcpl, g_alloc_options.alloc_time) >= 0);
+    }
+    assert(H5Pset_fill_time(dcpl, H5D_FILL_TIME_NEVER) >= 0);
+    hid_t type = H5Dget_type(src_id);
+    assert(type >= 0);
+    hid_t space = H5Dget_space(src_id);
+    assert(space >= 0);
+    hid_t dst_id = TRACE_CALL("H5Dcreate", H5Dcreate(dst_file_id, dset_names[i], type, space,
+                                                     H5P_DEFAULT, dcpl, H5P_DEFAULT));
+    assert(dst_id >= 0);
+    assert(H5Sclose(space) >= 0);
+    assert(H5Tclose(type) >= 0);
+    assert(H5Pclose(dcpl) >= 0);
+    assert(H5Pclose(src_dcpl) >= 0);
+
+    add_copy_tasks(&tasks, method, i, src_id, dst_id);
+    src_ids.push_back(src_id);
+    dst_ids.push_back(dst_id);
+    methods.push_back(method);
+  }
+  end_phase(&open_phase);
+  fprintf(stderr, "Total seconds to open %d source and create %d destination datasets: %f\n",
+          num_dsets, num_dsets, open_phase.seconds);
+  report_phase_counters(stderr, &open_phase);
+
+  int src_fd = -1;
+  int dst_fd = -1;
+  if (std::find(methods.begin(), methods.end(), CopyMethod::kRaw) != methods.end()) {
+    int *handle = 0;
+    assert(H5Fget_vfd_handle(src_file_id, H5P_DEFAULT, (void **)&handle) >= 0);
+    src_fd = *handle;
+    assert(H5Fget_vfd_handle(dst_file_id, H5P_DEFAULT, (void **)&handle) >= 0);
+    dst_fd = *handle;
+  }
+
+  uint64_t method_bytes[(int)CopyMethod::kCount] = {};
+  for (const CopyTask &task : tasks) {
+    method_bytes[(int)task.method] += task.bytes;
+  }
+  const uint64_t total_bytes = std::accumulate(method_bytes, method_bytes + (int)CopyMethod::kCount,
+                                               (uint64_t)0);
+  std::atomic<size_t> next_task(0);
+  std::atomic<bool> used_copy_file_range(true);
+
+  auto copy_func = [&]() {
+    std::vector<char> buf;
+    for (size_t i = next_task++; i < tasks.size(); i = next_task++) {
+      const CopyTask &task = tasks[i];
+      hid_t src_id = src_ids[task.dset_index];
+      hid_t dst_id = dst_ids[task.dset_index];
+      switch (task.method) {
+        case CopyMethod::kRaw: {
+          if (!copy_extent(src_fd, task.src_offset, dst_fd, task.dst_offset, task.bytes, &buf)) {
+            used_copy_file_range = false;
+          }
+          break;
+        }
+        case CopyMethod::kChunk: {
+          buf.resize(task.bytes);
+          uint32_t filter_mask = 0;
+          assert(TRACE_CALL("H5Dread_chunk", H5Dread_chunk(src_id, H5P_DEFAULT, task.start.data(),
+                                                           &filter_mask, buf.data())) >= 0);
+          assert(TRACE_CALL("H5Dwrite_chunk", H5Dwrite_chunk(dst_id, H5P_DEFAULT, filter_mask,
+                                                             task.start.data(), task.bytes,
+                                                             buf.data())) >= 0);
+          break;
+        }
+        case CopyMethod::kHyperslab: {
+          copy_hyperslab(src_id, dst_id, task, &buf);
+          break;
+        }
+        default: {
+          assert(!"Unknown copy method");
+        }
+      }
+    }
+  };
+
+  Phase phase("copy", true, options.num_threads, tasks.size(), total_bytes);
+  std::vector<std::thread> threads;
+  start_phase(&phase);
+  for (int i = 0; i < options.num_threads; ++i) {
+    threads.push_back(spawn_worker(&phase, i, copy_func));
+  }
+  join_workers(threads);
+  end_phase(&phase);
+
+  for (int i = 0; i < num_dsets; ++i) {
+    assert(TRACE_CALL("H5Dclose", H5Dclose(src_ids[i])) >= 0);
+  }
+  assert(TRACE_CALL("H5Fclose", H5Fclose(src_file_id)) >= 0);
+  flush_and_close(dst_file_id, dst_ids);
+
+  const double gbps = total_bytes / phase.seconds / (1024.0 * 1024.0 * 1024.0);
+  fprintf(stderr, "Total seconds to copy %d datasets with %d threads: %f\n", num_dsets,
+          options.num_threads, phase.seconds);
+  report_phase_counters(stderr, &phase);
+  for (int i = 0; i < (int)CopyMethod::kCount; ++i) {
+    int count = (int)std::count(methods.begin(), methods.end(), (CopyMethod)i);
+    if (count) {
+      fprintf(stderr, "    %d datasets, %llu bytes copied %s\n", count,
+              (unsigned long long)method_bytes[i], copy_method_names[i]);
+    }
+  }
+  if (!used_copy_file_range) {
+    fprintf(stderr, "    raw copies fell back to pread and pwrite\n");
+  }
+
+  return gbps;
+}
+
+// NOTE(chogan): Alternates the ceiling and the library copy for
+// options.num_trials trials each, so drift in the storage affects both, and
+// compares their means.
+bool run_copy(const CopyOptions &options, const char **dset_names, int num_dsets,
+              bool verify_results) {
+  prime_datasets(options.src_file_name, dset_names, num_dsets, 0);
+
+  std::vector<double> ceiling_gbps;
+  std::vector<double> copy_gbps;
+  for (int trial = 0; trial < options.num_trials; ++trial) {
+    if (options.num_trials > 1) {
+      fprintf(stderr, "Trial %d of %d\n", trial + 1, options.num_trials);
+    }
+    ceiling_gbps.push_back(measure_copy_ceiling(options, dset_names, num_dsets));
+    copy_gbps.push_back(copy_datasets(options, dset_names, num_dsets));
+  }
+
+  const double ceiling_mean = std::accumulate(ceiling_gbps.begin(), ceiling_gbps.end(), 0.0) /
+                              options.num_trials;
+  const double copy_mean = std::accumulate(copy_gbps.begin(), copy_gbps.end(), 0.0) /
+                           options.num_trials;
+  fprintf(stderr, "Copy with %d threads over %d trials: %f GB/s (stddev %f), %.1f%% of the "
+          "%f GB/s (stddev %f) copy ceiling\n", options.num_threads, options.num_trials,
+          copy_mean, sample_stddev(copy_gbps, copy_mean), 100.0 * copy_mean / ceiling_mean,
+          ceiling_mean, sample_stddev(ceiling_gbps, ceiling_mean));
+
+  if (verify_results && !verify_copy(options, dset_names, num_dsets)) {
+    fprintf(stderr, "Verification of the copy failed\n");
+    return false;
+  }
+
+  return true;
+}
+
+// NOTE(chogan): The default mode: open, read, and close num_dsets datasets (or
+// write them with -w) num_trials times, in threads, or with -P in processes
+struct DatasetOptions {
+  const char *in_file_name;
+  const char *out_file_name;
+  int num_threads;
+  int num_dsets;
+  int num_trials;
+  bool do_write;
+  bool use_processes;
+  bool use_manifest;
+  bool open_on_workers;
+  bool read_on_workers;
+  bool write_on_workers;
+  bool close_on_workers;
+  PipelineOptions pipeline;
+  const char *trace_file_name;
+};
+
+bool run_datasets(const DatasetOptions &options, const char **dset_names, bool verify_results) {
+  const char *in_file_name = options.in_file_name;
+  const char *out_file_name = options.out_file_name;
+  const char *trace_file_name = options.trace_file_name;
+  const int num_threads = options.num_threads;
+  const int num_dsets = options.num_dsets;
+  const bool do_write = options.do_write;
+  const bool use_manifest = options.use_manifest;
+
+  // NOTE(chogan): The main thread does the work for any phase that isn't run
+  // on workers, so it gets worker 0's placement.
+  pin_current_thread(0);
+
+  u64 *a = (u64 *)malloc(dset_size * sizeof(u64));
+  u64 *b = (u64 *)malloc(dset_size * sizeof(u64));
+  u64 *c = (u64 *)malloc(dset_size * sizeof(u64));
+  u64 *d = (u64 *)malloc(dset_size * sizeof(u64));
+  u64 *e = (u64 *)malloc(dset_size * sizeof(u64));
+  u64 *f = (u64 *)malloc(dset_size * sizeof(u64));
+  u64 *g = (u64 *)malloc(dset_size * sizeof(u64));
+  u64 *h = (u64 *)malloc(dset_size * sizeof(u64));
+
+  u64 *destinations[] = {a, b, c, d, e, f, g, h};
+  const int num_ids = num_threads == 1 ? num_dsets : num_threads;
+  std::vector<hid_t> dset_ids(num_ids);
+
+  bool result = true;
+  for (int trial = 0; trial < options.num_trials; ++trial) {
+    if (options.num_trials > 1) {
+      fprintf(stderr, "Trial %d of %d\n", trial + 1, options.num_trials);
+    }
+    if (options.use_processes) {
+      // NOTE(chogan): Children verify their own data, and write their own
+      // traces for the first trial
+      if (!run_processes(in_file_name, dset_names, num_dsets, num_threads, verify_results,
+                         use_manifest, trace_file_name)) {
+        result = false;
+        break;
+      }
+      verify_results = false;
+      trace_file_name = 0;
+    } else if (options.pipeline.enabled) {
+      write_pipelined(out_file_name, dset_names, num_dsets, num_threads, options.pipeline,
+                      use_manifest);
+    } else if (do_write) {
+      write_datasets(out_file_name, dset_names, num_dsets, num_threads, options.write_on_workers,
+                     use_manifest);
+    } else {
+      hid_t fapl = create_read_fapl();
+      hid_t file_id = TRACE_CALL("H5Fopen", H5Fopen(in_file_name, H5F_ACC_RDONLY, fapl));
+      assert(file_id >= 0 && "Failed to open file");
+      assert(H5Pclose(fapl) >= 0);
+
+      open_datasets(file_id, dset_ids, dset_names, num_dsets, num_threads,
+                    options.open_on_workers);
+      read_datasets(dset_ids, dset_names, num_dsets, destinations, num_threads,
+                    options.read_on_workers);
+      close_datasets(dset_ids, dset_names, num_dsets, num_threads, options.close_on_workers);
+
+      if (TRACE_CALL("H5Fclose", H5Fclose(file_id)) < 0) {
+        fprintf(stderr, "Failed to close file\n");
+      }
+    }
+  }
+
+  // NOTE(chogan): Stop vtune collection so the computationally expensive
+  // verification isn't added to the profile
+  // __itt_pause();
+
+  if (result && verify_results) {
+    fprintf(stderr, "Verifying results\n");
+    if (do_write) {
+      hid_t out_file_id = H5Fopen(out_file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+      assert(out_file_id >= 0);
+
+      for (int i = 0; i < num_dsets; ++i) {
+        hid_t dset_id = H5Dopen(out_file_id, dset_names[i], H5P_DEFAULT);
+        assert(dset_id >= 0);
+        assert(H5Dread(dset_id, H5T_NATIVE_ULONG, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                       destinations[i]) >= 0);
+        assert(H5Dclose(dset_id) >= 0);
+      }
+
+      if (use_manifest) {
+        assert(verify_datasets_against_manifest(out_file_name, dset_names, num_dsets, dset_size,
+                                                destinations) && "Verification failed");
+      } else {
+        assert(verify_datasets(num_dsets, dset_size, destinations) && "Verification failed");
+      }
+
+      assert(H5Fclose(out_file_id) >= 0);
+      assert(remove(out_file_name) == 0);
+      if (use_manifest) {
+        assert(remove(manifest_file_name(out_file_name).c_str()) == 0);
+      }
+    } else if (use_manifest) {
+      assert(verify_datasets_against_manifest(in_file_name, dset_names, num_dsets, dset_size,
+                                              destinations) && "Verification failed");
+    } else {
+      assert(verify_datasets(num_dsets, dset_size, destinations) && "Verification failed");
+    }
+    fprintf(stderr, "Success.\n");
+  }
+
+  free(a);
+  free(b);
+  free(c);
+  free(d);
+  free(e);
+  free(f);
+  free(g);
+  free(h);
+
+  return result;
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s -f file_name [-t num_threads] [-d num_dsets] [-p policy]\n", prog);
+  fprintf(stderr, "          [-T trace_file] [-n trials] [-o,-c,-e,-H,-r,-s,-P]\n");
+  fprintf(stderr, "          [--results file] [--baseline file] [--tolerance percent] [--tuned file]\n");
+  fprintf(stderr, "    -c: Close datasets in the worker threads\n");
+  fprintf(stderr, "    -e: Collect perf_event counters for each phase\n");
+  fprintf(stderr, "    -H: Verify against the XXH64 manifest 'file_name.xxh64' instead of\n");
+  fprintf(stderr, "        checking for arange contents. With -w, write the manifest too\n");
+  fprintf(stderr, "    -n: Run the open, read, write, and close phases 'trials' times\n");
+  fprintf(stderr, "    -o: Open datasets in the worker threads\n");
+  fprintf(stderr, "    -p: Pin threads with policy 'compact', 'scatter', 'physical', or a cpu list\n");
+  fprintf(stderr, "        like '0,2,4-7'. The default lets the scheduler place threads\n");
+  fprintf(stderr, "    -P: Open, read, and close in num_threads forked processes instead of threads\n");
+  fprintf(stderr, "    -r: Read datasets in the worker threads\n");
+  fprintf(stderr, "    -s: Skip verification of results\n");
+  fprintf(stderr, "    -T: Write a Chrome trace of every thread's calls to 'trace_file'\n");
+  fprintf(stderr, "    --pipeline: With -w, stream the data instead of generating it up front.\n");
+  fprintf(stderr, "        --pipeline-producers threads (default num_threads) fill windows of\n");
+  fprintf(stderr, "        --pipeline-window elements (default 1048576) in a pool of\n");
+  fprintf(stderr, "        --pipeline-buffers buffers (default 2 * (producers + num_threads))\n");
+  fprintf(stderr, "        while num_threads writer threads write them with H5Dwrite\n");
+  fprintf(stderr, "    --results: Save the configuration, machine, versions, and per-phase\n");
+  fprintf(stderr, "        statistics over all trials to 'file'. Works in every mode but\n");
+  fprintf(stderr, "        --swmr and --autotune\n");
+  fprintf(stderr, "    --baseline: Compare against results saved with --results and exit with 1\n");
+  fprintf(stderr, "        if a phase's time, worst trial, or throughput regressed by more than\n");
+  fprintf(stderr, "        the trial noise and --tolerance percent (default 5). Fails without\n");
+  fprintf(stderr, "        comparing if the baseline's configuration differs\n");
+  fprintf(stderr, "    --tuned: Use the thread count, affinity, request size, and buffer sizes\n");
+  fprintf(stderr, "        saved by --autotune in 'file'. Implies -r\n");
+  fprintf(stderr, "    --alloc-time: With -w, allocate dataset space 'early', 'incr', or 'late'\n");
+  fprintf(stderr, "    --fill-time: With -w, write the fill value on 'alloc', 'never', or 'ifset'\n");
+  fprintf(stderr, "    --fspace-strategy: With -w, manage file space with 'fsm', 'page', 'aggr',\n");
+  fprintf(stderr, "        or 'none'\n");
+  fprintf(stderr, "    --fspace-page-size: With -w, the file space page size in bytes\n");
+  fprintf(stderr, "    --write-chunk: With -w, write chunked datasets with chunks of 'elems'\n");
+  fprintf(stderr, "    --preallocate: With -w, reserve the file's blocks with fallocate from\n");
+  fprintf(stderr, "        num_threads threads in 64 MiB steps before the writers start\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --handles file_name [-t num_threads] [-d num_dsets] [-s]\n", prog);
+  fprintf(stderr, "    --handles: Run the open, read, and close phases with one shared file id,\n");
+  fprintf(stderr, "        with every worker calling H5Fopen (which the library dedups), and\n");
+  fprintf(stderr, "        with every worker opening independent file state through a driver\n");
+  fprintf(stderr, "        that never dedups, and report the gap. num_threads must equal\n");
+  fprintf(stderr, "        num_dsets, or num_dsets must be 1. Reads 'file', so no -f\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --alloc-sweep file_name [-t max_threads] [--alloc-time ...] [-s]\n", prog);
+  fprintf(stderr, "    --alloc-sweep: Write one dataset to 'file_name' with 1, 2, 4, ...\n");
+  fprintf(stderr, "        max_threads threads under the -w allocation options above and report\n");
+  fprintf(stderr, "        first write latency, later write latency, and throughput. Threads\n");
+  fprintf(stderr, "        write in requests of 1048576 elements\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --copy out_file -f file_name [-t num_threads] [-d num_dsets] [-n trials]\n", prog);
+  fprintf(stderr, "          [--copy-method auto|stream] [-s]\n");
+  fprintf(stderr, "    --copy: Copy num_dsets datasets from 'file_name' to a new 'out_file' with\n");
+  fprintf(stderr, "        num_threads threads. Contiguous datasets are copied as raw file\n");
+  fprintf(stderr, "        extents with copy_file_range, chunked datasets chunk by chunk with\n");
+  fprintf(stderr, "        H5Dread_chunk and H5Dwrite_chunk, and anything else (or everything,\n");
+  fprintf(stderr, "        with --copy-method stream) in hyperslab windows. Reports mean GB/s\n");
+  fprintf(stderr, "        over the trials against the mean of copying the same datasets'\n");
+  fprintf(stderr, "        stored bytes (no metadata) with copy_file_range\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --autotune out_file -f file_name [-t max_threads] [-d num_dsets]\n", prog);
+  fprintf(stderr, "          [--autotune-bytes bytes] [--tolerance percent]\n");
+  fprintf(stderr, "    --autotune: Search thread count, H5Dread request size, sieve and page\n");
+  fprintf(stderr, "        buffer sizes, and affinity policy for reading 'file_name' with\n");
+  fprintf(stderr, "        successive halving, and save the best config to 'out_file' for\n");
+  fprintf(stderr, "        --tuned. Probes start at --autotune-bytes (default 16777216) and\n");
+  fprintf(stderr, "        double each round. Stops once the best config leads the rest by\n");
+  fprintf(stderr, "        less than the measured noise or --tolerance percent\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --swmr file_name [-t max_readers] [--swmr-rate appends_per_sec]\n", prog);
+  fprintf(stderr, "          [--swmr-batch records] [--swmr-seconds seconds] [--swmr-poll-us us]\n");
+  fprintf(stderr, "    --swmr: One writer process appends to 'file_name' with SWMR while 1, 2, 4,\n");
+  fprintf(stderr, "        ... max_readers reader processes poll it. Reports visibility latency\n");
+  fprintf(stderr, "        and reader throughput. Defaults: 1000 appends/sec of 1 record for 5\n");
+  fprintf(stderr, "        seconds, polling every 100 us\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --ingest file_name [-t num_producers] [--ingest-records records]\n", prog);
+  fprintf(stderr, "          [--ingest-batch records] [--ingest-chunks sizes] [--ingest-flush n] [-s]\n");
+  fprintf(stderr, "    --ingest: Producer threads append records to an extendible dataset in\n");
+  fprintf(stderr, "        'file_name', one H5Dset_extent and H5Dwrite per batch. Runs once per\n");
+  fprintf(stderr, "        chunk size in the comma separated --ingest-chunks list and reports\n");
+  fprintf(stderr, "        records/sec and append latency. --ingest-flush calls H5Dflush every n\n");
+  fprintf(stderr, "        batches (0 never flushes). Defaults: 1048576 records per producer,\n");
+  fprintf(stderr, "        4096 records per batch, chunk sizes 1024,16384,131072, no flushes\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --stripe base_name [-t num_threads] [--stripe-member-size bytes] [-s]\n", prog);
+  fprintf(stderr, "    --stripe: Write and read one logical dataset split across num_threads\n");
+  fprintf(stderr, "        threads in a single file, a family of files with members of\n");
+  fprintf(stderr, "        --stripe-member-size bytes (default 268435456), one file per thread,\n");
+  fprintf(stderr, "        and a virtual dataset over the per-thread files. Files are named\n");
+  fprintf(stderr, "        after 'base_name' and removed afterwards\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "       %s --selections file_name [-t max_threads] [--selection-side N] [-s]\n", prog);
+  fprintf(stderr, "    --selections: Read an N^3 dataset with strided, block-strided, irregular\n");
+  fprintf(stderr, "        union, point, and non-contiguous memory selections at 1, 2, 4, ...\n");
+  fprintf(stderr, "        max_threads threads and report sequences per second and bytes per\n");
+  fprintf(stderr, "        sequence. N defaults to 384 and must be a multiple of 8\n");
+  exit(1);
+}
+
+enum LongOption {
+  kOptionSwmr = 256,
+  kOptionSwmrRate,
+  kOptionSwmrBatch,
+  kOptionSwmrSeconds,
+  kOptionSwmrPollUs,
+  kOptionIngest,
+  kOptionIngestRecords,
+  kOptionIngestBatch,
+  kOptionIngestChunks,
+  kOptionIngestFlush,
+  kOptionStripe,
+  kOptionStripeMemberSize,
+  kOptionSelections,
+  kOptionSelectionSide,
+  kOptionResults,
+  kOptionBaseline,
+  kOptionTolerance,
+  kOptionAutotune,
+  kOptionAutotuneBytes,
+  kOptionTuned,
+  kOptionPipeline,
+  kOptionPipelineProducers,
+  kOptionPipelineBuffers,
+  kOptionPipelineWindow,
+  kOptionHandles,
+  kOptionAllocTime,
+  kOptionFillTime,
+  kOptionFspaceStrategy,
+  kOptionFspacePageSize,
+  kOptionWriteChunk,
+  kOptionPreallocate,
+  kOptionAllocSweep,
+  kOptionCopy,
+  kOptionCopyMethod,
+};
+
+const option long_options[] = {
+  {"swmr", required_argument, 0, kOptionSwmr},
+  {"swmr-rate", required_argument, 0, kOptionSwmrRate},
+  {"swmr-batch", required_argument, 0, kOptionSwmrBatch},
+  {"swmr-seconds", required_argument, 0, kOptionSwmrSeconds},
+  {"swmr-poll-us", required_argument, 0, kOptionSwmrPollUs},
+  {"ingest", required_argument, 0, kOptionIngest},
+  {"ingest-records", required_argument, 0, kOptionIngestRecords},
+  {"ingest-batch", required_argument, 0, kOptionIngestBatch},
+  {"ingest-chunks", required_argument, 0, kOptionIngestChunks},
+  {"ingest-flush", required_argument, 0, kOptionIngestFlush},
+  {"stripe", required_argument, 0, kOptionStripe},
+  {"stripe-member-size", required_argument, 0, kOptionStripeMemberSize},
+  {"selections", required_argument, 0, kOptionSelections},
+  {"selection-side", required_argument, 0, kOptionSelectionSide},
+  {"results", required_argument, 0, kOptionResults},
+  {"baseline", required_argument, 0, kOptionBaseline},
+  {"tolerance", required_argument, 0, kOptionTolerance},
+  {"autotune", required_argument, 0, kOptionAutotune},
+  {"autotune-bytes", required_argument, 0, kOptionAutotuneBytes},
+  {"tuned", required_argument, 0, kOptionTuned},
+  {"pipeline", no_argument, 0, kOptionPipeline},
+  {"pipeline-producers", required_argument, 0, kOptionPipelineProducers},
+  {"pipeline-buffers", required_argument, 0, kOptionPipelineBuffers},
+  {"pipeline-window", required_argument, 0, kOptionPipelineWindow},
+  {"handles", required_argument, 0, kOptionHandles},
+  {"alloc-time", required_argument, 0, kOptionAllocTime},
+  {"fill-time", required_argument, 0, kOptionFillTime},
+  {"fspace-strategy", required_argument, 0, kOptionFspaceStrategy},
+  {"fspace-page-size", required_argument, 0, kOptionFspacePageSize},
+  {"write-chunk", required_argument, 0, kOptionWriteChunk},
+  {"preallocate", no_argument, 0, kOptionPreallocate},
+  {"alloc-sweep", required_argument, 0, kOptionAllocSweep},
+  {"copy", required_argument, 0, kOptionCopy},
+  {"copy-method", required_argument, 0, kOptionCopyMethod},
+  {0, 0, 0, 0},
+};
+
+enum Mode {
+  kModeRead,
+  kModeWrite,
+  kModeProcesses,
+  kModeSwmr,
+  kModeIngest,
+  kModeStripe,
+  kModeSelections,
+  kModeAutotune,
+  kModeHandles,
+  kModeAllocSweep,
+  kModeCopy,
+  kModeCount,
+};
+
+const char *mode_names[kModeCount] = {"read", "write", "processes", "swmr", "ingest", "stripe",
+                                      "selections", "autotune", "handles", "alloc-sweep", "copy"};
+
+int main (int argc, char* argv[]) {
+
+  if (argc < 2) {
+    usage(argv[0]);
+  }
+
+  int option = -1;
+  int num_threads = 1;
+  int num_dsets = 8;
+  char *in_file_name = 0;
+  char *out_file_name = 0;
+  char *trace_file_name = 0;
+  bool verify_results = true;
+  bool do_write = false;
+  bool open_on_workers = false;
+  bool read_on_workers = false;
+  bool write_on_workers = false;
+  bool close_on_workers = false;
+  bool use_processes = false;
+  bool use_manifest = false;
+  int num_trials = 1;
+  char *results_file_name = 0;
+  char *baseline_file_name = 0;
+  double tolerance = 0.05;
+  char *tuned_file_name = 0;
+  TuneOptions tune_options = {0, 16 * 1024 * 1024, 0, 0};
+  PipelineOptions pipeline_options = {false, 0, 0, 1024 * 1024};
+  char *handles_file_name = 0;
+  char *alloc_sweep_file_name = 0;
+  CopyOptions copy_options = {0, 0, 0, 1, false};
+  SwmrOptions swmr_options = {0, 0, 1000, 1, 5, 100};
+  IngestOptions ingest_options = {0, 0, 1024 * 1024, 4096, {1024, 16384, 131072}, 0};
+  StripeOptions stripe_options = {0, 256 * 1024 * 1024, 0};
+  SelectionOptions selection_options = {0, 384, 0};
+
+  while ((option = getopt_long(argc, argv, "acd:ef:Hn:op:PrsT:t:w:", long_options, 0)) != -1) {
+    switch (option) {
+      case 'a': {
+        write_on_workers = true;
+        break;
+      }
+      case 'c': {
+        close_on_workers = true;
+        break;
+      }
+      case 'd': {
+        num_dsets = atoi(optarg);
+        assert(num_dsets <= max_dsets);
+        break;
+      }
+      case 'e': {
+        g_perf_enabled = true;
+        break;
+      }
+      case 'f': {
+        in_file_name = optarg;
+        break;
+      }
+      case 'H': {
+        use_manifest = true;
+        break;
+      }
+      case 'n': {
+        num_trials = atoi(optarg);
+        assert(num_trials >= 1);
+        break;
+      }
+      case 'o': {
+        open_on_workers = true;
+        break;
+      }
+      case 'p': {
+        if (!parse_affinity(optarg, &g_affinity)) {
+          fprintf(stderr, "Invalid affinity policy '%s'.\n", optarg);
+          usage(argv[0]);
+        }
+        break;
+      }
+      case 'P': {
+        use_processes = true;
+        break;
+      }
+      case 'r': {
+        read_on_workers = true;
+        break;
+      }
+      case 's': {
+        verify_results = false;
+        break;
+      }
+      case 'T': {
+        trace_file_name = optarg;
+        g_trace_enabled = true;
+        break;
+      }
+      case 't': {
+        num_threads = atoi(optarg);
+        assert(num_threads <= max_dsets);
+        break;
+      }
+      case 'w': {
+        do_write = true;
+        out_file_name = optarg;
+        break;
+      }
+      case kOptionSwmr: {
+        swmr_options.file_name = optarg;
+        break;
+      }
+      case kOptionSwmrRate: {
+        swmr_options.appends_per_second = atof(optarg);
+        break;
+      }
+      case kOptionSwmrBatch: {
+        swmr_options.records_per_append = atoi(optarg);
+        break;
+      }
+      case kOptionSwmrSeconds: {
+        swmr_options.seconds = atof(optarg);
+        break;
+      }
+      case kOptionSwmrPollUs: {
+        swmr_options.poll_us = atoi(optarg);
+        break;
+      }
+      case kOptionIngest: {
+        ingest_options.file_name = optarg;
+        break;
+      }
+      case kOptionIngestRecords: {
+        ingest_options.records_per_producer = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionIngestBatch: {
+        ingest_options.records_per_batch = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionIngestChunks: {
+        if (!parse_size_list(optarg, &ingest_options.chunk_sizes)) {
+          fprintf(stderr, "Invalid chunk size list '%s'.\n", optarg);
+          usage(argv[0]);
+        }
+        break;
+      }
+      case kOptionIngestFlush: {
+        ingest_options.flush_every = atoi(optarg);
+        break;
+      }
+      case kOptionStripe: {
+        stripe_options.base_name = optarg;
+        break;
+      }
+      case kOptionStripeMemberSize: {
+        stripe_options.family_member_bytes = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionSelections: {
+        selection_options.file_name = optarg;
+        break;
+      }
+      case kOptionSelectionSide: {
+        selection_options.side = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionResults: {
+        results_file_name = optarg;
+        g_record_phases = true;
+        break;
+      }
+      case kOptionBaseline: {
+        baseline_file_name = optarg;
+        g_record_phases = true;
+        break;
+      }
+      case kOptionTolerance: {
+        tolerance = atof(optarg) / 100.0;
+        break;
+      }
+      case kOptionAutotune: {
+        tune_options.output_file_name = optarg;
+        break;
+      }
+      case kOptionAutotuneBytes: {
+        tune_options.initial_probe_bytes = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionTuned: {
+        tuned_file_name = optarg;
+        break;
+      }
+      case kOptionPipeline: {
+        pipeline_options.enabled = true;
+        break;
+      }
+      case kOptionPipelineProducers: {
+        pipeline_options.num_producers = atoi(optarg);
+        break;
+      }
+      case kOptionPipelineBuffers: {
+        pipeline_options.num_buffers = atoi(optarg);
+        break;
+      }
+      case kOptionPipelineWindow: {
+        pipeline_options.window_elems = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionHandles: {
+        handles_file_name = optarg;
+        break;
+      }
+      case kOptionAllocTime: {
+        if (!parse_alloc_time(optarg, &g_alloc_options.alloc_time)) {
+          fprintf(stderr, "Invalid allocation time '%s'.\n", optarg);
+          usage(argv[0]);
+        }
+        break;
+      }
+      case kOptionFillTime: {
+        if (!parse_fill_time(optarg, &g_alloc_options.fill_time)) {
+          fprintf(stderr, "Invalid fill time '%s'.\n", optarg);
+          usage(argv[0]);
+        }
+        g_alloc_options.set_fill_time = true;
+        break;
+      }
+      case kOptionFspaceStrategy: {
+        if (!parse_fspace_strategy(optarg, &g_alloc_options.strategy)) {
+          fprintf(stderr, "Invalid file space strategy '%s'.\n", optarg);
+          usage(argv[0]);
+        }
+        g_alloc_options.set_strategy = true;
+        break;
+      }
+      case kOptionFspacePageSize: {
+        g_alloc_options.page_size = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionWriteChunk: {
+        g_alloc_options.chunk_elems = strtoull(optarg, 0, 10);
+        break;
+      }
+      case kOptionPreallocate: {
+        g_alloc_options.preallocate = true;
+        break;
+      }
+      case kOptionAllocSweep: {
+        alloc_sweep_file_name = optarg;
+        break;
+      }
+      case kOptionCopy: {
+        copy_options.dst_file_name = optarg;
+        break;
+      }
+      case kOptionCopyMethod: {
+        if (strcmp(optarg, "stream") == 0) {
+          copy_options.stream_only = true;
+        } else if (strcmp(optarg, "auto") != 0) {
+          fprintf(stderr, "Invalid copy method '%s'.\n", optarg);
+          usage(argv[0]);
+        }
+        break;
+      }
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (optind < argc) {
+    fprintf(stderr, "Got unknown argument '%s'.\n", argv[optind]);
+    usage(argv[0]);
+  }
+
+  const char *dset_names[] = {"a", "b", "c", "d", "e", "f", "g", "h"};
+  Mode mode = kModeRead;
+  const char *mode_file_name = do_write ? out_file_name : in_file_name;
+  if (swmr_options.file_name) {
+    mode = kModeSwmr;
+    mode_file_name = swmr_options.file_name;
+    if (trace_file_name) {
+      fprintf(stderr, "-T isn't supported with --swmr, which runs in untraced child processes.\n");
+      usage(argv[0]);
+    }
+    swmr_options.max_readers = num_threads;
+  } else if (ingest_options.file_name) {
+    mode = kModeIngest;
+    mode_file_name = ingest_options.file_name;
+    ingest_options.num_producers = num_threads;
+  } else if (stripe_options.base_name) {
+    mode = kModeStripe;
+    mode_file_name = stripe_options.base_name;
+    stripe_options.num_threads = num_threads;
+  } else if (selection_options.file_name) {
+    mode = kModeSelections;
+    mode_file_name = selection_options.file_name;
+    selection_options.max_threads = num_threads;
+  } else if (tune_options.output_file_name) {
+    mode = kModeAutotune;
+    if (!in_file_name) {
+      fprintf(stderr, "--autotune needs the file to tune against with -f.\n");
+      usage(argv[0]);
+    }
+    tune_options.max_threads = num_threads;
+    tune_options.tolerance = tolerance;
+  } else if (handles_file_name) {
+    mode = kModeHandles;
+    mode_file_name = handles_file_name;
+    if (in_file_name) {
+      fprintf(stderr, "--handles reads the file it names, so it doesn't take -f.\n");
+      usage(argv[0]);
+    }
+    if (num_dsets != 1 && num_dsets != num_threads) {
+      fprintf(stderr, "--handles needs num_dsets equal to num_threads, or 1.\n");
+      usage(argv[0]);
+    }
+    if (num_dsets == 1 && dset_size % num_threads != 0) {
+      fprintf(stderr, "--handles with one dataset needs num_threads to divide its %d elements.\n",
+              dset_size);
+      usage(argv[0]);
+    }
+  } else if (alloc_sweep_file_name) {
+    mode = kModeAllocSweep;
+    mode_file_name = alloc_sweep_file_name;
+  } else if (copy_options.dst_file_name) {
+    mode = kModeCopy;
+    mode_file_name = in_file_name;
+    if (!in_file_name) {
+      fprintf(stderr, "--copy needs the source file with -f.\n");
+      usage(argv[0]);
+    }
+    copy_options.src_file_name = in_file_name;
+    copy_options.num_threads = num_threads;
+    copy_options.num_trials = num_trials;
+  } else {
+    if (tuned_file_name) {
+      if (!load_tune_config(tuned_file_name, &num_threads)) {
+        return 1;
+      }
+      // NOTE(chogan): The tuned thread count is for reads on workers, which is
+      // what the probes measured
+      read_on_workers = true;
+    }
+
+    assert(do_write ? out_file_name : in_file_name);
+    assert((num_threads == num_dsets || num_threads == 1 || num_dsets == 1) && "Invalid configuration");
+    if (num_dsets == 1) {
+      assert(dset_size % num_threads == 0);
+    }
+    assert(!(use_processes && do_write) && "Process mode only supports reads");
+    if (use_processes && num_dsets != 1 && num_dsets != num_threads) {
+      fprintf(stderr, "Process mode needs num_dsets equal to num_threads, or 1.\n");
+      usage(argv[0]);
+    }
+    if (pipeline_options.enabled && !do_write) {
+      fprintf(stderr, "--pipeline needs -w.\n");
+      usage(argv[0]);
+    }
+    if (pipeline_options.enabled) {
+      if (!pipeline_options.num_producers) {
+        pipeline_options.num_producers = num_threads;
+      }
+      if (!pipeline_options.num_buffers) {
+        pipeline_options.num_buffers = 2 * (pipeline_options.num_producers + num_threads);
+      }
+    }
+    mode = use_processes ? kModeProcesses : (do_write ? kModeWrite : kModeRead);
+  }
+  // NOTE(chogan): --swmr reports latency histograms from its child processes
+  // and --autotune only runs unrecorded probes, so neither has phases to save
+  // or compare
+  if ((mode == kModeSwmr || mode == kModeAutotune) && (results_file_name || baseline_file_name)) {
+    fprintf(stderr, "--results and --baseline aren't supported with --%s.\n", mode_names[mode]);
+    usage(argv[0]);
+  }
+
+  init_affinity(&g_affinity);
+  print_affinity(stderr);
+  set_trace_thread_name("main");
+  // NOTE(chogan): The parent never touches the library in process mode, so
+  // each child starts from fresh library state and warms up on its own.
+  if (mode != kModeProcesses) {
+    warm_up_library(true);
+  }
+
+  bool success = false;
+  switch (mode) {
+    case kModeRead:
+    case kModeWrite:
+    case kModeProcesses: {
+      DatasetOptions dataset_options = {in_file_name, out_file_name, num_threads, num_dsets,
+                                        num_trials, do_write, use_processes, use_manifest,
+                                        open_on_workers, read_on_workers, write_on_workers,
+                                        close_on_workers, pipeline_options, trace_file_name};
+      success = run_datasets(dataset_options, dset_names, verify_results);
+      break;
+    }
+    case kModeSwmr: {
+      success = run_swmr(swmr_options);
+      break;
+    }
+    case kModeIngest: {
+      success = run_ingest(ingest_options, verify_results);
+      break;
+    }
+    case kModeStripe: {
+      success = run_stripe(stripe_options, verify_results);
+      break;
+    }
+    case kModeSelections: {
+      success = run_selections(selection_options, verify_results);
+      break;
+    }
+    case kModeAutotune: {
+      success = run_autotune(tune_options, in_file_name, dset_names, num_dsets);
+      break;
+    }
+    case kModeHandles: {
+      success = run_handle_comparison(handles_file_name, dset_names, num_dsets, num_threads,
+                                      verify_results);
+      break;
+    }
+    case kModeAllocSweep: {
+      success = run_alloc_sweep(alloc_sweep_file_name, num_threads, verify_results);
+      break;
+    }
+    case kModeCopy: {
+      success = run_copy(copy_options, dset_names, num_dsets, verify_results);
+      break;
+    }
+    case kModeCount: {
+      break;
+    }
+  }
+
+  // NOTE(chogan): Every mode ends here. In process mode the children wrote
+  // their own traces.
+  if (trace_file_name && mode != kModeProcesses) {
+    write_trace(trace_file_name);
+  }
+  if (!success) {
+    return 1;
+  }
+
+  if (g_record_phases) {
+    Results results;
+    set_result(&results, "config.mode", "%s", mode_names[mode]);
+    set_result(&results, "config.file", "%s", mode_file_name);
+    set_result(&results, "config.threads", "%d", num_threads);
+    set_result(&results, "config.dsets", "%d", num_dsets);
+    set_result(&results, "config.dset_size", "%d", dset_size);
+    set_result(&results, "config.open_on_workers", "%d", open_on_workers);
+    set_result(&results, "config.read_on_workers", "%d", read_on_workers);
+    set_result(&results, "config.write_on_workers", "%d", write_on_workers);
+    set_result(&results, "config.close_on_workers", "%d", close_on_workers);
+    set_result(&results, "config.affinity", "%s", affinity_policy_name(g_affinity.policy));
+    // NOTE(chogan): The cpus workers were actually pinned to, so two different
+    // cpu lists (or one policy on different topologies) don't compare equal
+    std::string affinity_cpus;
+    for (int cpu : g_affinity.cpus) {
+      affinity_cpus += (affinity_cpus.empty() ? "" : ",") + std::to_string(cpu);
+    }
+    set_result(&results, "config.affinity_cpus", "%s",
+               affinity_cpus.empty() ? "none" : affinity_cpus.c_str());
+    set_result(&results, "config.request_elems", "%llu", (unsigned long long)g_request_elems);
+    set_result(&results, "config.sieve_bytes", "%zu", g_sieve_bytes);
+    set_result(&results, "config.page_buffer_bytes", "%zu", g_page_buffer_bytes);
+    set_result(&results, "config.alloc_time", "%d", (int)g_alloc_options.alloc_time);
+    set_result(&results, "config.fill_time", "%d",
+               g_alloc_options.set_fill_time ? (int)g_alloc_options.fill_time : -1);
+    set_result(&results, "config.fspace_strategy", "%d",
+               g_alloc_options.set_strategy ? (int)g_alloc_options.strategy : -1);
+    set_result(&results, "config.fspace_page_size", "%llu",
+               (unsigned long long)g_alloc_options.page_size);
+    set_result(&results, "config.write_chunk", "%llu",
+               (unsigned long long)g_alloc_options.chunk_elems);
+    set_result(&results, "config.preallocate", "%d", g_alloc_options.preallocate);
+    set_result(&results, "config.trials", "%d", num_trials);
+    switch (mode) {
+      case kModeIngest: {
+        std::string chunk_sizes;
+        for (hsize_t chunk_size : ingest_options.chunk_sizes) {
+          chunk_sizes += (chunk_sizes.empty() ? "" : ",") + std::to_string(chunk_size);
+        }
+        set_result(&results, "config.ingest_records", "%llu",
+                   (unsigned long long)ingest_options.records_per_producer);
+        set_result(&results, "config.ingest_batch", "%llu",
+                   (unsigned long long)ingest_options.records_per_batch);
+        set_result(&results, "config.ingest_chunks", "%s", chunk_sizes.c_str());
+        set_result(&results, "config.ingest_flush", "%d", ingest_options.flush_every);
+        break;
+      }
+      case kModeStripe: {
+        set_result(&results, "config.stripe_member_size", "%llu",
+                   (unsigned long long)stripe_options.family_member_bytes);
+        break;
+      }
+      case kModeSelections: {
+        set_result(&results, "config.selection_side", "%llu",
+                   (unsigned long long)selection_options.side);
+        break;
+      }
+      case kModeCopy: {
+        set_result(&results, "config.copy_method", "%s",
+                   copy_options.stream_only ? "stream" : "auto");
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+    add_machine_results(&results);
+    std::vector<PhaseStats> phases = summarize_phases(g_phase_records);
+    add_phase_results(&results, phases);
+
+    if (results_file_name && !write_results(results_file_name, results)) {
+      return 1;
+    }
+    if (baseline_file_name) {
+      ResultMap baseline;
+      if (!read_results(baseline_file_name, &baseline) ||
+          !compare_results(baseline_file_name, baseline, results, phases, tolerance)) {
+        return 1;
+      }
+    }
+  }
 
   return 0;
 }
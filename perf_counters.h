@@ -0,0 +1,184 @@
+#ifndef MTH5_PERF_COUNTERS_H_
+#define MTH5_PERF_COUNTERS_H_
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+
+enum PerfCounter {
+  // NOTE(chogan): Hardware group
+  kPerfInstructions,
+  kPerfCycles,
+  kPerfCacheMisses,
+  // NOTE(chogan): Software group
+  kPerfContextSwitches,
+  kPerfCpuMigrations,
+  kPerfPageFaults,
+
+  kPerfCount
+};
+
+const int kPerfFirstSoftware = kPerfContextSwitches;
+
+static const char *perf_counter_names[kPerfCount] = {
+  "instructions", "cycles", "cache-misses", "context-switches", "cpu-migrations", "page-faults",
+};
+
+struct PerfValues {
+  uint64_t values[kPerfCount];
+  bool has_hardware;
+  bool has_software;
+};
+
+// NOTE(chogan): One hardware and one software group, opened on the calling
+// thread. The groups are separate so the software counters still work on
+// machines (VMs, containers) where the PMU isn't exposed.
+struct PerfGroup {
+  int fds[kPerfCount];
+};
+
+static bool g_perf_enabled = false;
+// NOTE(chogan): Only warn once per run when counters are unavailable
+static std::atomic<bool> g_perf_warned_hardware(false);
+static std::atomic<bool> g_perf_warned_software(false);
+
+static int perf_event_open(perf_event_attr *attr, int group_fd) {
+  // NOTE(chogan): pid 0 and cpu -1 count the calling thread on any CPU
+  return (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static int open_perf_counter(uint32_t type, uint64_t config, int group_fd) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group_fd == -1 ? 1 : 0;
+  attr.read_format = (PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                      PERF_FORMAT_TOTAL_TIME_RUNNING);
+
+  int fd = perf_event_open(&attr, group_fd);
+  if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+    // NOTE(chogan): perf_event_paranoid >= 2 only allows user space counting
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = perf_event_open(&attr, group_fd);
+  }
+
+  return fd;
+}
+
+static void close_perf_group(PerfGroup *group) {
+  for (int i = 0; i < kPerfCount; ++i) {
+    if (group->fds[i] >= 0) {
+      close(group->fds[i]);
+      group->fds[i] = -1;
+    }
+  }
+}
+
+static bool open_perf_range(PerfGroup *group, int first, int last, const uint32_t *types,
+                            const uint64_t *configs) {
+  for (int i = first; i < last; ++i) {
+    int leader = i == first ? -1 : group->fds[first];
+    group->fds[i] = open_perf_counter(types[i], configs[i], leader);
+    if (group->fds[i] < 0) {
+      for (int j = first; j < i; ++j) {
+        close(group->fds[j]);
+        group->fds[j] = -1;
+      }
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void open_perf_group(PerfGroup *group) {
+  static const uint32_t types[kPerfCount] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+    PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE,
+  };
+  static const uint64_t configs[kPerfCount] = {
+    PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS, PERF_COUNT_SW_PAGE_FAULTS,
+  };
+
+  for (int i = 0; i < kPerfCount; ++i) {
+    group->fds[i] = -1;
+  }
+
+  if (!open_perf_range(group, 0, kPerfFirstSoftware, types, configs) &&
+      !g_perf_warned_hardware.exchange(true)) {
+    fprintf(stderr, "Hardware perf counters unavailable (%s), using software counters only\n",
+            strerror(errno));
+  }
+  if (!open_perf_range(group, kPerfFirstSoftware, kPerfCount, types, configs) &&
+      !g_perf_warned_software.exchange(true)) {
+    fprintf(stderr, "Software perf counters unavailable (%s)\n", strerror(errno));
+  }
+}
+
+static void start_perf_group(const PerfGroup *group) {
+  const int leaders[] = {kPerfInstructions, kPerfFirstSoftware};
+  for (int leader : leaders) {
+    if (group->fds[leader] >= 0) {
+      ioctl(group->fds[leader], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(group->fds[leader], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+  }
+}
+
+static void read_perf_range(const PerfGroup *group, int first, int last, PerfValues *result) {
+  int leader = group->fds[first];
+  if (leader < 0) {
+    return;
+  }
+  ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  // NOTE(chogan): PERF_FORMAT_GROUP layout: nr, time_enabled, time_running, values[nr]
+  uint64_t buf[3 + kPerfCount] = {};
+  ssize_t bytes = read(leader, buf, sizeof(buf));
+  if (bytes < (ssize_t)(3 * sizeof(uint64_t)) || buf[0] != (uint64_t)(last - first)) {
+    return;
+  }
+
+  // NOTE(chogan): Scale for multiplexing when more groups than PMU slots are active
+  double scale = 1.0;
+  if (buf[2] > 0 && buf[2] < buf[1]) {
+    scale = (double)buf[1] / (double)buf[2];
+  }
+  for (int i = first; i < last; ++i) {
+    result->values[i] = (uint64_t)(buf[3 + i - first] * scale);
+  }
+  if (first == 0) {
+    result->has_hardware = true;
+  } else {
+    result->has_software = true;
+  }
+}
+
+static PerfValues stop_perf_group(const PerfGroup *group) {
+  PerfValues result = {};
+  read_perf_range(group, 0, kPerfFirstSoftware, &result);
+  read_perf_range(group, kPerfFirstSoftware, kPerfCount, &result);
+
+  return result;
+}
+
+static void add_perf_values(PerfValues *total, const PerfValues &values) {
+  for (int i = 0; i < kPerfCount; ++i) {
+    total->values[i] += values.values[i];
+  }
+  total->has_hardware |= values.has_hardware;
+  total->has_software |= values.has_software;
+}
+
+#endif  // MTH5_PERF_COUNTERS_H_
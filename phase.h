@@ -0,0 +1,182 @@
+#ifndef MTH5_PHASE_H_
+#define MTH5_PHASE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "affinity.h"
+#include "perf_counters.h"
+#include "trace.h"
+
+// NOTE(chogan): A timed section of the benchmark (open, read, write, close).
+// Workers started with spawn_worker() for a phase add their counters to it. If
+// the phase runs on the main thread, the main thread's counters are used.
+struct Phase {
+  const char *name;
+  bool on_workers;
+  int num_threads;
+  // NOTE(chogan): Number of API calls (H5Dopen, H5Dread, pread, ...) the phase makes
+  uint64_t calls;
+  // NOTE(chogan): Number of bytes moved by the phase, or 0 if it doesn't move data
+  uint64_t bytes;
+  double seconds;
+  // NOTE(chogan): Whether the phase goes in the results file. Warm up,
+  // hashing, verification, and other bookkeeping phases aren't what a run
+  // measures, and their noise shouldn't fail a baseline comparison.
+  bool recorded;
+
+  std::chrono::high_resolution_clock::time_point start;
+  std::chrono::high_resolution_clock::time_point end;
+  int64_t trace_start_ns;
+
+  std::mutex mutex;
+  PerfValues counters;
+  PerfGroup main_group;
+
+  Phase(const char *name, bool on_workers, int num_threads, uint64_t calls, uint64_t bytes,
+        bool recorded = true)
+      : name(name), on_workers(on_workers), num_threads(on_workers ? num_threads : 1),
+        calls(calls), bytes(bytes), seconds(0), recorded(recorded), trace_start_ns(0),
+        counters() {}
+};
+
+// NOTE(chogan): Every recorded phase that finishes while g_record_phases is set, in
+// order, for the results file (see results.h). Phases only end on the main
+// thread, so no lock is needed.
+struct PhaseRecord {
+  std::string name;
+  int num_threads;
+  uint64_t bytes;
+  double seconds;
+};
+
+static bool g_record_phases = false;
+static std::vector<PhaseRecord> g_phase_records;
+// NOTE(chogan): Set by modes that sweep a setting (1, 2, 4, ... threads, or
+// one chunk size at a time) and reuse phase names for each step, so each step
+// gets its own name in the results file. Empty otherwise.
+static std::string g_phase_step;
+
+static void record_phase(const Phase *phase) {
+  if (g_record_phases && phase->recorded) {
+    std::string name = g_phase_step.empty() ? phase->name : phase->name + (" " + g_phase_step);
+    g_phase_records.push_back({name, phase->num_threads, phase->bytes, phase->seconds});
+  }
+}
+
+static void add_phase_counters(Phase *phase, const PerfValues &values) {
+  int64_t wait_start = g_trace_enabled ? trace_now_ns() : 0;
+  std::lock_guard<std::mutex> lock(phase->mutex);
+  if (g_trace_enabled) {
+    record_trace_event("phase mutex", "lock", wait_start, trace_now_ns());
+  }
+  add_perf_values(&phase->counters, values);
+}
+
+static void start_phase(Phase *phase) {
+  if (g_perf_enabled && !phase->on_workers) {
+    open_perf_group(&phase->main_group);
+    start_perf_group(&phase->main_group);
+  }
+  __itt_task_begin(g_itt_domain, __itt_null, __itt_null, __itt_string_handle_create(phase->name));
+  phase->trace_start_ns = g_trace_enabled ? trace_now_ns() : 0;
+  phase->start = std::chrono::high_resolution_clock::now();
+}
+
+static void end_phase(Phase *phase) {
+  phase->end = std::chrono::high_resolution_clock::now();
+  phase->seconds = std::chrono::duration<double>(phase->end - phase->start).count();
+  record_phase(phase);
+  if (g_trace_enabled) {
+    record_trace_event(phase->name, "phase", phase->trace_start_ns, trace_now_ns());
+  }
+  __itt_task_end(g_itt_domain);
+  if (g_perf_enabled && !phase->on_workers) {
+    add_phase_counters(phase, stop_perf_group(&phase->main_group));
+    close_perf_group(&phase->main_group);
+  }
+}
+
+// NOTE(chogan): Waits for every worker of a phase. The wait shows up in the
+// trace as a barrier on the main thread.
+static void join_workers(std::vector<std::thread> &threads) {
+  TRACE_SCOPE("join workers", "barrier");
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+}
+
+static void report_phase_counters(FILE *out, const Phase *phase) {
+  if (!g_perf_enabled) {
+    return;
+  }
+
+  const PerfValues &counters = phase->counters;
+  fprintf(out, "Counters for %s:", phase->name);
+  for (int i = 0; i < kPerfCount; ++i) {
+    bool available = i < kPerfFirstSoftware ? counters.has_hardware : counters.has_software;
+    if (available) {
+      fprintf(out, " %s=%llu", perf_counter_names[i], (unsigned long long)counters.values[i]);
+    } else {
+      fprintf(out, " %s=n/a", perf_counter_names[i]);
+    }
+  }
+  fprintf(out, "\n");
+
+  if (counters.has_hardware && phase->bytes > 0) {
+    fprintf(out, "    %s instructions per byte: %f\n", phase->name,
+            (double)counters.values[kPerfInstructions] / (double)phase->bytes);
+  }
+  if (counters.has_hardware && phase->calls > 0) {
+    fprintf(out, "    %s instructions per call: %f\n", phase->name,
+            (double)counters.values[kPerfInstructions] / (double)phase->calls);
+  }
+  if (counters.has_software && phase->calls > 0) {
+    fprintf(out, "    %s context switches per call: %f\n", phase->name,
+            (double)counters.values[kPerfContextSwitches] / (double)phase->calls);
+  }
+}
+
+// NOTE(chogan): Starts a worker thread for `phase` that pins itself according
+// to g_affinity before running `func`. Pinning and counter setup happen on the
+// worker so they are in place before its first call, rather than racing the
+// parent.
+template<typename Func, typename... Args>
+std::thread spawn_worker(Phase *phase, int worker, Func &&func, Args &&...args) {
+  auto task = std::bind(std::forward<Func>(func), std::forward<Args>(args)...);
+
+  return std::thread([phase, worker, task]() mutable {
+    pin_current_thread(worker);
+    if (g_trace_enabled) {
+      char name[32];
+      snprintf(name, sizeof(name), "worker %d", worker);
+      set_trace_thread_name(name);
+    }
+
+    PerfGroup group;
+    if (g_perf_enabled) {
+      open_perf_group(&group);
+      start_perf_group(&group);
+    }
+
+    {
+      TraceScope scope(phase->name, "worker", __itt_string_handle_create(phase->name));
+      task();
+    }
+
+    if (g_perf_enabled) {
+      add_phase_counters(phase, stop_perf_group(&group));
+      close_perf_group(&group);
+    }
+  });
+}
+
+#endif  // MTH5_PHASE_H_
@@ -0,0 +1,347 @@
+#ifndef MTH5_RESULTS_H_
+#define MTH5_RESULTS_H_
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hdf5.h"
+
+#include "affinity.h"
+#include "phase.h"
+
+// NOTE(chogan): Set by the Makefile from `git rev-parse`
+#ifndef MTH5_GIT_HASH
+#define MTH5_GIT_HASH "unknown"
+#endif
+
+// NOTE(chogan): Structured results of a run: the configuration, the machine,
+// the library and harness versions, and per-phase statistics over every trial.
+// The file is flat "key value" text (one pair per line, like the manifest) so
+// it diffs cleanly and can be read without a parser:
+//   config.threads 8
+//   machine.cores 16
+//   phase.read.seconds.mean 0.412345
+// Phase names have spaces replaced with '-' in keys.
+typedef std::vector<std::pair<std::string, std::string>> Results;
+typedef std::map<std::string, std::string> ResultMap;
+
+// NOTE(chogan): A regression must exceed both the noise threshold (a multiple
+// of the standard error from the trial variance) and the relative tolerance.
+// Phases faster than kResultsMinSeconds are dominated by timer noise, so
+// differences below it are never regressions.
+const double kResultsNoiseSigmas = 3.0;
+const double kResultsMinSeconds = 1e-4;
+
+struct PhaseStats {
+  std::string name;
+  int num_threads;
+  uint64_t bytes;
+  int trials;
+  double mean_seconds;
+  double stddev_seconds;
+  double min_seconds;
+  double max_seconds;
+  double mean_gbps;
+  double stddev_gbps;
+};
+
+static void set_result(Results *results, const std::string &key, const char *format, ...) {
+  char value[4096];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(value, sizeof(value), format, args);
+  va_end(args);
+
+  results->push_back({key, value});
+}
+
+static std::string phase_key(const std::string &name) {
+  std::string result = "phase.";
+  for (char c : name) {
+    result += (c == ' ' ? '-' : c);
+  }
+
+  return result;
+}
+
+static double sample_stddev(const std::vector<double> &values, double mean) {
+  if (values.size() < 2) {
+    return 0;
+  }
+  double sum = 0;
+  for (double value : values) {
+    sum += (value - mean) * (value - mean);
+  }
+
+  return sqrt(sum / (values.size() - 1));
+}
+
+// NOTE(chogan): Groups records by phase name, in the order phases first ran
+static std::vector<PhaseStats> summarize_phases(const std::vector<PhaseRecord> &records) {
+  std::vector<PhaseStats> result;
+  std::vector<std::vector<double>> seconds;
+  std::vector<std::vector<double>> gbps;
+  for (const PhaseRecord &record : records) {
+    size_t index = 0;
+    while (index < result.size() && result[index].name != record.name) {
+      ++index;
+    }
+    if (index == result.size()) {
+      PhaseStats stats = {};
+      stats.name = record.name;
+      stats.num_threads = record.num_threads;
+      stats.bytes = record.bytes;
+      result.push_back(stats);
+      seconds.push_back({});
+      gbps.push_back({});
+    }
+    seconds[index].push_back(record.seconds);
+    if (record.bytes > 0 && record.seconds > 0) {
+      gbps[index].push_back(record.bytes / record.seconds / (1024.0 * 1024.0 * 1024.0));
+    }
+  }
+
+  for (size_t i = 0; i < result.size(); ++i) {
+    PhaseStats *stats = &result[i];
+    stats->trials = (int)seconds[i].size();
+    double sum = 0;
+    for (double value : seconds[i]) {
+      sum += value;
+    }
+    stats->mean_seconds = sum / stats->trials;
+    stats->stddev_seconds = sample_stddev(seconds[i], stats->mean_seconds);
+    stats->min_seconds = *std::min_element(seconds[i].begin(), seconds[i].end());
+    stats->max_seconds = *std::max_element(seconds[i].begin(), seconds[i].end());
+    if (!gbps[i].empty()) {
+      sum = 0;
+      for (double value : gbps[i]) {
+        sum += value;
+      }
+      stats->mean_gbps = sum / gbps[i].size();
+      stats->stddev_gbps = sample_stddev(gbps[i], stats->mean_gbps);
+    }
+  }
+
+  return result;
+}
+
+static void add_machine_results(Results *results) {
+  char host_name[256] = {};
+  if (gethostname(host_name, sizeof(host_name) - 1) != 0) {
+    snprintf(host_name, sizeof(host_name), "unknown");
+  }
+  unsigned major = 0, minor = 0, release = 0;
+  H5get_libversion(&major, &minor, &release);
+
+  set_result(results, "machine.host", "%s", host_name);
+  set_result(results, "machine.sockets", "%d", g_affinity.num_packages);
+  set_result(results, "machine.cores", "%d", g_affinity.num_cores);
+  set_result(results, "machine.cpus", "%d", (int)read_cpu_topology().size());
+  set_result(results, "library.hdf5", "%u.%u.%u", major, minor, release);
+  set_result(results, "library.git", "%s", MTH5_GIT_HASH);
+}
+
+static void add_phase_results(Results *results, const std::vector<PhaseStats> &phases) {
+  for (const PhaseStats &stats : phases) {
+    std::string key = phase_key(stats.name);
+    set_result(results, key + ".threads", "%d", stats.num_threads);
+    set_result(results, key + ".bytes", "%llu", (unsigned long long)stats.bytes);
+    set_result(results, key + ".trials", "%d", stats.trials);
+    set_result(results, key + ".seconds.mean", "%.9f", stats.mean_seconds);
+    set_result(results, key + ".seconds.stddev", "%.9f", stats.stddev_seconds);
+    set_result(results, key + ".seconds.min", "%.9f", stats.min_seconds);
+    set_result(results, key + ".seconds.max", "%.9f", stats.max_seconds);
+    if (stats.bytes > 0) {
+      set_result(results, key + ".gbps.mean", "%.9f", stats.mean_gbps);
+      set_result(results, key + ".gbps.stddev", "%.9f", stats.stddev_gbps);
+    }
+  }
+}
+
+static bool write_results(const char *file_name, const Results &results) {
+  FILE *file = fopen(file_name, "w");
+  if (!file) {
+    fprintf(stderr, "Failed to open results file %s\n", file_name);
+    return false;
+  }
+  for (const auto &result : results) {
+    fprintf(file, "%s %s\n", result.first.c_str(), result.second.c_str());
+  }
+  fclose(file);
+  fprintf(stderr, "Wrote results to %s\n", file_name);
+
+  return true;
+}
+
+static bool read_results(const char *file_name, ResultMap *results) {
+  FILE *file = fopen(file_name, "r");
+  if (!file) {
+    fprintf(stderr, "Failed to open baseline file %s\n", file_name);
+    return false;
+  }
+  char line[4096];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\n")] = '\0';
+    char *space = strchr(line, ' ');
+    if (space) {
+      *space = '\0';
+      (*results)[line] = space + 1;
+    }
+  }
+  fclose(file);
+
+  return true;
+}
+
+static double result_double(const ResultMap &results, const std::string &key, bool *found) {
+  auto it = results.find(key);
+  *found = it != results.end();
+
+  return *found ? atof(it->second.c_str()) : 0;
+}
+
+// NOTE(chogan): Prints one metric of the diff and returns whether it regressed.
+// `lower_is_better` is true for times, false for throughput.
+static bool compare_metric(const std::string &name, double baseline, double current,
+                           double threshold, bool lower_is_better) {
+  double change = lower_is_better ? current - baseline : baseline - current;
+  bool regressed = change > threshold;
+  const char *status = regressed ? "REGRESSION" : (-change > threshold ? "improved" : "ok");
+  fprintf(stderr, "  %-36s %14.6f -> %14.6f  %+7.1f%%  (threshold %.1f%%)  %s\n", name.c_str(),
+          baseline, current, baseline != 0 ? 100.0 * (current - baseline) / baseline : 0.0,
+          baseline != 0 ? 100.0 * threshold / baseline : 0.0, status);
+
+  return regressed;
+}
+
+// NOTE(chogan): Compares the mean time, worst trial (tail), and mean throughput
+// of every phase that is in both runs. `tolerance` is the minimum relative
+// change (0.05 == 5%) that counts as a regression. Returns false if anything
+// regressed.
+static bool compare_results(const char *baseline_name, const ResultMap &baseline,
+                            const Results &current, const std::vector<PhaseStats> &phases,
+                            double tolerance) {
+  auto baseline_value = [&baseline](const std::string &key) {
+    auto it = baseline.find(key);
+    return it == baseline.end() ? std::string("missing") : it->second;
+  };
+
+  fprintf(stderr, "Comparing against baseline %s (git %s, HDF5 %s)\n", baseline_name,
+          baseline_value("library.git").c_str(), baseline_value("library.hdf5").c_str());
+  // NOTE(chogan): A different machine or library version is what a comparison
+  // is often for, but a different configuration measures something else, so
+  // its phases aren't compared at all
+  bool same_config = true;
+  for (const auto &result : current) {
+    bool is_config = result.first.compare(0, 7, "config.") == 0;
+    if (is_config || result.first.compare(0, 8, "machine.") == 0 ||
+        result.first.compare(0, 8, "library.") == 0) {
+      std::string value = baseline_value(result.first);
+      if (value != result.second) {
+        fprintf(stderr, "  %s differs: baseline %s, current %s\n", result.first.c_str(),
+                value.c_str(), result.second.c_str());
+        if (is_config) {
+          same_config = false;
+        }
+      }
+    }
+  }
+  for (const auto &entry : baseline) {
+    if (entry.first.compare(0, 7, "config.") != 0) {
+      continue;
+    }
+    bool found = false;
+    for (const auto &result : current) {
+      if (result.first == entry.first) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "  %s differs: baseline %s, current missing\n", entry.first.c_str(),
+              entry.second.c_str());
+      same_config = false;
+    }
+  }
+  if (!same_config) {
+    fprintf(stderr, "The configuration differs from the baseline, so the runs can't be "
+            "compared.\n");
+    return false;
+  }
+
+  bool result = true;
+  for (const PhaseStats &stats : phases) {
+    std::string key = phase_key(stats.name);
+    bool found = false;
+    double mean = result_double(baseline, key + ".seconds.mean", &found);
+    if (!found) {
+      fprintf(stderr, "  %s is not in the baseline\n", stats.name.c_str());
+      continue;
+    }
+    double stddev = result_double(baseline, key + ".seconds.stddev", &found);
+    double max = result_double(baseline, key + ".seconds.max", &found);
+    double trials = std::max(result_double(baseline, key + ".trials", &found), 1.0);
+
+    double standard_error = sqrt(stddev * stddev / trials +
+                                 stats.stddev_seconds * stats.stddev_seconds / stats.trials);
+    double threshold = std::max({kResultsNoiseSigmas * standard_error, tolerance * mean,
+                                 kResultsMinSeconds});
+    if (compare_metric(stats.name + " seconds", mean, stats.mean_seconds, threshold, true)) {
+      result = false;
+    }
+
+    // NOTE(chogan): The worst trial is a single sample, so its noise is the
+    // spread of one trial rather than of the mean
+    threshold = std::max({kResultsNoiseSigmas * std::max(stddev, stats.stddev_seconds),
+                          tolerance * max, kResultsMinSeconds});
+    if (compare_metric(stats.name + " max seconds", max, stats.max_seconds, threshold, true)) {
+      result = false;
+    }
+
+    double gbps = result_double(baseline, key + ".gbps.mean", &found);
+    if (found && stats.bytes > 0) {
+      double gbps_stddev = result_double(baseline, key + ".gbps.stddev", &found);
+      standard_error = sqrt(gbps_stddev * gbps_stddev / trials +
+                            stats.stddev_gbps * stats.stddev_gbps / stats.trials);
+      threshold = std::max(kResultsNoiseSigmas * standard_error, tolerance * gbps);
+      if (compare_metric(stats.name + " GB/s", gbps, stats.mean_gbps, threshold, false)) {
+        result = false;
+      }
+    }
+  }
+
+  const std::string mean_suffix = ".seconds.mean";
+  for (const auto &entry : baseline) {
+    const std::string &key = entry.first;
+    if (key.compare(0, 6, "phase.") != 0 || key.size() <= mean_suffix.size() ||
+        key.compare(key.size() - mean_suffix.size(), mean_suffix.size(), mean_suffix) != 0) {
+      continue;
+    }
+    std::string name = key.substr(0, key.size() - mean_suffix.size());
+    bool ran = false;
+    for (const PhaseStats &stats : phases) {
+      if (phase_key(stats.name) == name) {
+        ran = true;
+        break;
+      }
+    }
+    if (!ran) {
+      fprintf(stderr, "  %s is in the baseline but didn't run\n", name.substr(6).c_str());
+    }
+  }
+  fprintf(stderr, "%s\n", result ? "No regressions." : "Performance regressed.");
+
+  return result;
+}
+
+#endif  // MTH5_RESULTS_H_
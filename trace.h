@@ -0,0 +1,188 @@
+#ifndef MTH5_TRACE_H_
+#define MTH5_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+
+#include "ittnotify.h"
+
+// NOTE(chogan): Timeline of every API call, phase, barrier, and lock wait,
+// written as Chrome/Perfetto trace JSON (load it in chrome://tracing or
+// ui.perfetto.dev). Each thread records into its own ring buffer so tracing
+// adds no synchronization between workers. The same spans are emitted as ITT
+// tasks so they also show up in VTune when a collector is attached.
+
+struct TraceEvent {
+  const char *name;
+  const char *category;
+  int64_t start_ns;
+  int64_t end_ns;
+};
+
+// NOTE(chogan): Must be a power of 2. Once a thread has recorded this many
+// events, the oldest are overwritten.
+const uint64_t kTraceBufferCapacity = 64 * 1024;
+
+struct TraceBuffer {
+  TraceEvent events[kTraceBufferCapacity];
+  // NOTE(chogan): Only written by the owning thread. Read by the main thread
+  // after the owner has been joined.
+  std::atomic<uint64_t> head;
+  long tid;
+  char thread_name[32];
+  TraceBuffer *next;
+};
+
+static bool g_trace_enabled = false;
+static std::atomic<TraceBuffer *> g_trace_buffers(nullptr);
+static thread_local TraceBuffer *t_trace_buffer = nullptr;
+static const auto g_trace_epoch = std::chrono::steady_clock::now();
+static __itt_domain *g_itt_domain = __itt_domain_create("mth5");
+
+static int64_t trace_now_ns() {
+  auto elapsed = std::chrono::steady_clock::now() - g_trace_epoch;
+
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+static TraceBuffer *get_trace_buffer() {
+  TraceBuffer *result = t_trace_buffer;
+  if (!result) {
+    // NOTE(chogan): Buffers are never freed so the dump at exit can read the
+    // buffers of threads that have already finished.
+    result = new TraceBuffer;
+    result->head.store(0, std::memory_order_relaxed);
+    result->tid = syscall(SYS_gettid);
+    snprintf(result->thread_name, sizeof(result->thread_name), "thread %ld", result->tid);
+    result->next = g_trace_buffers.load(std::memory_order_relaxed);
+    while (!g_trace_buffers.compare_exchange_weak(result->next, result, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+    }
+    t_trace_buffer = result;
+  }
+
+  return result;
+}
+
+static void set_trace_thread_name(const char *name) {
+  if (g_trace_enabled) {
+    TraceBuffer *buffer = get_trace_buffer();
+    snprintf(buffer->thread_name, sizeof(buffer->thread_name), "%s", name);
+  }
+}
+
+static void record_trace_event(const char *name, const char *category, int64_t start_ns,
+                               int64_t end_ns) {
+  TraceBuffer *buffer = get_trace_buffer();
+  uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  TraceEvent *event = &buffer->events[head & (kTraceBufferCapacity - 1)];
+  event->name = name;
+  event->category = category;
+  event->start_ns = start_ns;
+  event->end_ns = end_ns;
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+// NOTE(chogan): Records a span from construction to destruction. `name` and
+// `category` must be string literals (or otherwise outlive the dump).
+struct TraceScope {
+  const char *name;
+  const char *category;
+  int64_t start_ns;
+
+  TraceScope(const char *name, const char *category, __itt_string_handle *itt_handle)
+      : name(name), category(category), start_ns(0) {
+    __itt_task_begin(g_itt_domain, __itt_null, __itt_null, itt_handle);
+    if (g_trace_enabled) {
+      start_ns = trace_now_ns();
+    }
+  }
+
+  ~TraceScope() {
+    if (g_trace_enabled) {
+      record_trace_event(name, category, start_ns, trace_now_ns());
+    }
+    __itt_task_end(g_itt_domain);
+  }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// NOTE(chogan): The ITT string handle is created once per call site.
+#define TRACE_SCOPE(name, category)                                                        \
+  static __itt_string_handle *TRACE_CONCAT(itt_handle_, __LINE__) =                        \
+      __itt_string_handle_create(name);                                                    \
+  TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, category,                          \
+                                                  TRACE_CONCAT(itt_handle_, __LINE__))
+
+// NOTE(chogan): Evaluates `expr` inside an "api" span and returns its value,
+// so calls can be traced in place: assert(TRACE_CALL("H5Dclose", H5Dclose(id)) >= 0);
+#define TRACE_CALL(name, expr)   \
+  ([&]() {                       \
+    TRACE_SCOPE(name, "api");    \
+    return (expr);               \
+  }())
+
+static void write_trace_string(FILE *file, const char *str) {
+  fputc('"', file);
+  for (const char *p = str; *p; ++p) {
+    if (*p == '"' || *p == '\\') {
+      fputc('\\', file);
+    }
+    fputc(*p, file);
+  }
+  fputc('"', file);
+}
+
+// NOTE(chogan): Must only be called once all traced threads have been joined.
+static void write_trace(const char *file_name) {
+  FILE *file = fopen(file_name, "w");
+  if (!file) {
+    fprintf(stderr, "Failed to open trace file %s\n", file_name);
+    return;
+  }
+
+  int pid = (int)getpid();
+  uint64_t total_events = 0;
+  uint64_t dropped_events = 0;
+  bool first = true;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (TraceBuffer *buffer = g_trace_buffers.load(std::memory_order_acquire); buffer;
+       buffer = buffer->next) {
+    fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":",
+            first ? "" : ",\n", pid, buffer->tid);
+    write_trace_string(file, buffer->thread_name);
+    fprintf(file, "}}");
+    first = false;
+
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t begin = head > kTraceBufferCapacity ? head - kTraceBufferCapacity : 0;
+    dropped_events += begin;
+    for (uint64_t i = begin; i < head; ++i) {
+      const TraceEvent *event = &buffer->events[i & (kTraceBufferCapacity - 1)];
+      fprintf(file, ",\n{\"ph\":\"X\",\"name\":");
+      write_trace_string(file, event->name);
+      fprintf(file, ",\"cat\":");
+      write_trace_string(file, event->category);
+      fprintf(file, ",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}", pid, buffer->tid,
+              event->start_ns / 1000.0, (event->end_ns - event->start_ns) / 1000.0);
+      ++total_events;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+
+  fprintf(stderr, "Wrote %llu trace events to %s", (unsigned long long)total_events, file_name);
+  if (dropped_events) {
+    fprintf(stderr, " (%llu oldest events were overwritten)", (unsigned long long)dropped_events);
+  }
+  fprintf(stderr, "\n");
+}
+
+#endif  // MTH5_TRACE_H_
@@ -0,0 +1,408 @@
+#ifndef MTH5_VERIFY_H_
+#define MTH5_VERIFY_H_
+
+#include <assert.h>
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "affinity.h"
+#include "phase.h"
+
+// NOTE(chogan): Verification engine shared by mth5 and mt_posix_io. Checking
+// 512M elements on one thread took longer than the read being measured, so
+// the work is split into blocks across a pool of pinned threads. Each block is
+// either checked against the arange contents the generators write (with
+// AVX-512 or AVX2 when the CPU has them), or hashed with XXH64 so arbitrary
+// data can be compared against a manifest.
+
+// NOTE(chogan): Elements per unit of work. Also the hash block size, so it
+// must never change without regenerating manifests.
+const size_t kVerifyBlockBytes = 1024 * 1024;
+const size_t kVerifyBlockElems = kVerifyBlockBytes / sizeof(uint64_t);
+
+//
+// Arithmetic sequence kernels. Each returns the index of the first element
+// that isn't first + index, or count if they all match.
+//
+
+static size_t find_sequence_mismatch_scalar(const uint64_t *data, size_t count, uint64_t first) {
+  for (size_t i = 0; i < count; ++i) {
+    if (data[i] != first + i) {
+      return i;
+    }
+  }
+
+  return count;
+}
+
+__attribute__((target("avx2")))
+static size_t find_sequence_mismatch_avx2(const uint64_t *data, size_t count, uint64_t first) {
+  __m256i expected_lo = _mm256_setr_epi64x(first, first + 1, first + 2, first + 3);
+  __m256i expected_hi = _mm256_add_epi64(expected_lo, _mm256_set1_epi64x(4));
+  const __m256i step = _mm256_set1_epi64x(8);
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(data + i + 4));
+    __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi64(lo, expected_lo),
+                                  _mm256_cmpeq_epi64(hi, expected_hi));
+    if (_mm256_movemask_epi8(eq) != -1) {
+      break;
+    }
+    expected_lo = _mm256_add_epi64(expected_lo, step);
+    expected_hi = _mm256_add_epi64(expected_hi, step);
+  }
+
+  return i + find_sequence_mismatch_scalar(data + i, count - i, first + i);
+}
+
+__attribute__((target("avx512f")))
+static size_t find_sequence_mismatch_avx512(const uint64_t *data, size_t count, uint64_t first) {
+  __m512i expected_lo = _mm512_add_epi64(_mm512_set1_epi64(first),
+                                         _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+  __m512i expected_hi = _mm512_add_epi64(expected_lo, _mm512_set1_epi64(8));
+  const __m512i step = _mm512_set1_epi64(16);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m512i lo = _mm512_loadu_si512((const void *)(data + i));
+    __m512i hi = _mm512_loadu_si512((const void *)(data + i + 8));
+    if (_mm512_cmpneq_epu64_mask(lo, expected_lo) | _mm512_cmpneq_epu64_mask(hi, expected_hi)) {
+      break;
+    }
+    expected_lo = _mm512_add_epi64(expected_lo, step);
+    expected_hi = _mm512_add_epi64(expected_hi, step);
+  }
+
+  return i + find_sequence_mismatch_scalar(data + i, count - i, first + i);
+}
+
+typedef size_t (*SequenceKernel)(const uint64_t *data, size_t count, uint64_t first);
+
+static SequenceKernel select_sequence_kernel(const char **name) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    *name = "avx512";
+    return find_sequence_mismatch_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    *name = "avx2";
+    return find_sequence_mismatch_avx2;
+  }
+  *name = "scalar";
+
+  return find_sequence_mismatch_scalar;
+}
+
+//
+// XXH64
+//
+
+const uint64_t kXxhPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kXxhPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kXxhPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kXxhPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kXxhPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p) {
+  uint64_t result;
+  memcpy(&result, p, sizeof(result));
+
+  return result;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p) {
+  uint32_t result;
+  memcpy(&result, p, sizeof(result));
+
+  return result;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * kXxhPrime2;
+  acc = xxh_rotl(acc, 31);
+
+  return acc * kXxhPrime1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val) {
+  acc ^= xxh_round(0, val);
+
+  return acc * kXxhPrime1 + kXxhPrime4;
+}
+
+static uint64_t xxh64(const void *input, size_t len, uint64_t seed) {
+  const uint8_t *p = (const uint8_t *)input;
+  const uint8_t *end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    const uint8_t *limit = end - 32;
+    uint64_t v1 = seed + kXxhPrime1 + kXxhPrime2;
+    uint64_t v2 = seed + kXxhPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kXxhPrime1;
+    do {
+      v1 = xxh_round(v1, xxh_read64(p));
+      v2 = xxh_round(v2, xxh_read64(p + 8));
+      v3 = xxh_round(v3, xxh_read64(p + 16));
+      v4 = xxh_round(v4, xxh_read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+    h = xxh_merge_round(h, v1);
+    h = xxh_merge_round(h, v2);
+    h = xxh_merge_round(h, v3);
+    h = xxh_merge_round(h, v4);
+  } else {
+    h = seed + kXxhPrime5;
+  }
+
+  h += (uint64_t)len;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxh_round(0, xxh_read64(p));
+    h = xxh_rotl(h, 27) * kXxhPrime1 + kXxhPrime4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)xxh_read32(p) * kXxhPrime1;
+    h = xxh_rotl(h, 23) * kXxhPrime2 + kXxhPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= (*p) * kXxhPrime5;
+    h = xxh_rotl(h, 11) * kXxhPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= kXxhPrime2;
+  h ^= h >> 29;
+  h *= kXxhPrime3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+//
+// Parallel driver
+//
+
+// NOTE(chogan): One thread per pinned CPU, or per hardware thread if threads
+// aren't pinned.
+static int verify_thread_count(size_t num_blocks) {
+  int result = g_affinity.cpus.empty() ? (int)std::thread::hardware_concurrency()
+                                       : (int)g_affinity.cpus.size();
+
+  return std::max(1, std::min(result, (int)num_blocks));
+}
+
+// NOTE(chogan): Calls `func(block_index)` for every block in [0, num_blocks),
+// split into contiguous ranges across the verify threads.
+template<typename Func>
+void for_each_block(Phase *phase, size_t num_blocks, Func func) {
+  int num_threads = verify_thread_count(num_blocks);
+  std::vector<std::thread> threads;
+  size_t blocks_per_thread = (num_blocks + num_threads - 1) / num_threads;
+
+  auto block_func = [&func](size_t first, size_t last) {
+    for (size_t block = first; block < last; ++block) {
+      func(block);
+    }
+  };
+
+  for (int i = 0; i < num_threads; ++i) {
+    size_t first = std::min(num_blocks, i * blocks_per_thread);
+    size_t last = std::min(num_blocks, first + blocks_per_thread);
+    threads.push_back(spawn_worker(phase, i, block_func, first, last));
+  }
+  join_workers(threads);
+}
+
+// NOTE(chogan): Checks that element j of every destination is `j`, the
+// contents written by create_test_file.py and the generators in this repo.
+static bool verify_datasets(int num_dsets, int dset_size, uint64_t **destinations) {
+  const char *kernel_name = 0;
+  SequenceKernel kernel = select_sequence_kernel(&kernel_name);
+  size_t blocks_per_dset = ((size_t)dset_size + kVerifyBlockElems - 1) / kVerifyBlockElems;
+  size_t num_blocks = blocks_per_dset * num_dsets;
+
+  // NOTE(chogan): Lowest mismatching element per dataset, or dset_size
+  std::vector<std::atomic<size_t>> first_mismatch(num_dsets);
+  for (int i = 0; i < num_dsets; ++i) {
+    first_mismatch[i].store(dset_size);
+  }
+
+  Phase phase("verify", true, verify_thread_count(num_blocks), num_blocks,
+              (uint64_t)num_dsets * dset_size * sizeof(uint64_t), false);
+  start_phase(&phase);
+  for_each_block(&phase, num_blocks, [&](size_t block) {
+    size_t dset = block / blocks_per_dset;
+    size_t first = (block % blocks_per_dset) * kVerifyBlockElems;
+    size_t count = std::min(kVerifyBlockElems, (size_t)dset_size - first);
+    size_t mismatch = first + kernel(destinations[dset] + first, count, first);
+    if (mismatch < first + count) {
+      size_t current = first_mismatch[dset].load();
+      while (mismatch < current && !first_mismatch[dset].compare_exchange_weak(current, mismatch)) {
+      }
+    }
+  });
+  end_phase(&phase);
+
+  fprintf(stderr, "Total seconds to verify %d datasets with %d threads (%s): %f\n", num_dsets,
+          phase.num_threads, kernel_name, phase.seconds);
+  report_phase_counters(stderr, &phase);
+
+  bool result = true;
+  for (int i = 0; i < num_dsets; ++i) {
+    size_t index = first_mismatch[i].load();
+    if (index < (size_t)dset_size) {
+      fprintf(stderr, "Dataset %d: element %zu is %llu, expected %zu\n", i, index,
+              (unsigned long long)destinations[i][index], index);
+      result = false;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(chogan): XXH64 of each kVerifyBlockBytes block (the last may be
+// short), then XXH64 of the little endian block digests. Blocks hash
+// independently so the work parallelizes. create_test_file.py computes the
+// same digest with the xxhash module.
+static std::vector<uint64_t> hash_buffers(const std::vector<const void *> &buffers, size_t bytes) {
+  size_t blocks_per_buffer = (bytes + kVerifyBlockBytes - 1) / kVerifyBlockBytes;
+  size_t num_blocks = blocks_per_buffer * buffers.size();
+  std::vector<uint64_t> block_digests(num_blocks);
+
+  Phase phase("hash", true, verify_thread_count(num_blocks), num_blocks,
+              (uint64_t)buffers.size() * bytes, false);
+  start_phase(&phase);
+  for_each_block(&phase, num_blocks, [&](size_t block) {
+    size_t buffer = block / blocks_per_buffer;
+    size_t offset = (block % blocks_per_buffer) * kVerifyBlockBytes;
+    size_t len = std::min(kVerifyBlockBytes, bytes - offset);
+    block_digests[block] = xxh64((const uint8_t *)buffers[buffer] + offset, len, 0);
+  });
+  end_phase(&phase);
+
+  fprintf(stderr, "Total seconds to hash %zu datasets with %d threads: %f\n", buffers.size(),
+          phase.num_threads, phase.seconds);
+  report_phase_counters(stderr, &phase);
+
+  std::vector<uint64_t> result;
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    result.push_back(xxh64(block_digests.data() + i * blocks_per_buffer,
+                           blocks_per_buffer * sizeof(uint64_t), 0));
+  }
+
+  return result;
+}
+
+//
+// Manifests
+//
+
+// NOTE(chogan): One line per dataset: "name num_bytes digest", digest in hex.
+// Lives next to the data file as 'file_name.xxh64'.
+struct ManifestEntry {
+  std::string name;
+  uint64_t bytes;
+  uint64_t digest;
+};
+
+static std::string manifest_file_name(const char *file_name) {
+  return std::string(file_name) + ".xxh64";
+}
+
+static void write_manifest(const char *file_name, const std::vector<ManifestEntry> &entries) {
+  std::string name = manifest_file_name(file_name);
+  FILE *file = fopen(name.c_str(), "w");
+  assert(file);
+  for (const ManifestEntry &entry : entries) {
+    fprintf(file, "%s %llu %016llx\n", entry.name.c_str(), (unsigned long long)entry.bytes,
+            (unsigned long long)entry.digest);
+  }
+  assert(fclose(file) == 0);
+  fprintf(stderr, "Wrote manifest %s\n", name.c_str());
+}
+
+static bool read_manifest(const char *file_name, std::vector<ManifestEntry> *entries) {
+  std::string name = manifest_file_name(file_name);
+  FILE *file = fopen(name.c_str(), "r");
+  if (!file) {
+    fprintf(stderr, "Failed to open manifest %s\n", name.c_str());
+    return false;
+  }
+
+  char entry_name[256];
+  unsigned long long bytes = 0;
+  unsigned long long digest = 0;
+  while (fscanf(file, "%255s %llu %llx", entry_name, &bytes, &digest) == 3) {
+    entries->push_back({entry_name, bytes, digest});
+  }
+  fclose(file);
+
+  return true;
+}
+
+// NOTE(chogan): Writes a manifest for `num_dsets` datasets named `dset_names`
+// that all hold the same `bytes` bytes of `data`.
+static void write_uniform_manifest(const char *file_name, const char **dset_names, int num_dsets,
+                                   const void *data, size_t bytes) {
+  uint64_t digest = hash_buffers({data}, bytes)[0];
+  std::vector<ManifestEntry> entries;
+  for (int i = 0; i < num_dsets; ++i) {
+    entries.push_back({dset_names[i], bytes, digest});
+  }
+  write_manifest(file_name, entries);
+}
+
+static bool verify_datasets_against_manifest(const char *file_name, const char **dset_names,
+                                             int num_dsets, int dset_size,
+                                             uint64_t **destinations) {
+  std::vector<ManifestEntry> entries;
+  if (!read_manifest(file_name, &entries)) {
+    return false;
+  }
+
+  size_t bytes = (size_t)dset_size * sizeof(uint64_t);
+  std::vector<const void *> buffers(destinations, destinations + num_dsets);
+  std::vector<uint64_t> digests = hash_buffers(buffers, bytes);
+
+  bool result = true;
+  for (int i = 0; i < num_dsets; ++i) {
+    const ManifestEntry *entry = 0;
+    for (const ManifestEntry &candidate : entries) {
+      if (candidate.name == dset_names[i]) {
+        entry = &candidate;
+        break;
+      }
+    }
+    if (!entry) {
+      fprintf(stderr, "Dataset %s is not in the manifest\n", dset_names[i]);
+      result = false;
+    } else if (entry->bytes != bytes || entry->digest != digests[i]) {
+      fprintf(stderr, "Dataset %s: digest %016llx over %zu bytes, manifest has %016llx over %llu\n",
+              dset_names[i], (unsigned long long)digests[i], bytes,
+              (unsigned long long)entry->digest, (unsigned long long)entry->bytes);
+      result = false;
+    }
+  }
+
+  return result;
+}
+
+#endif  // MTH5_VERIFY_H_
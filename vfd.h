@@ -0,0 +1,166 @@
+#ifndef MTH5_VFD_H_
+#define MTH5_VFD_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "hdf5.h"
+
+// NOTE(chogan): A virtual file driver that forwards everything to a sec2 file
+// opened through the public H5FD API, but whose `cmp` never reports two files
+// as the same. When H5Fopen finds an already open file whose driver compares
+// equal it reuses that file's H5F_shared_t and H5FD_t, so every H5Fopen of a
+// path normally ends up on one shared file struct and one file descriptor.
+// With this driver each H5Fopen gets its own shared state and descriptor.
+
+struct NodedupFile {
+  // NOTE(chogan): Must be first. The library fills it in after open.
+  H5FD_t pub;
+  H5FD_t *inner;
+};
+
+static H5FD_t *nodedup_open(const char *name, unsigned flags, hid_t fapl_id, haddr_t maxaddr) {
+  (void)fapl_id;
+  hid_t inner_fapl = H5Pcreate(H5P_FILE_ACCESS);
+  if (inner_fapl < 0 || H5Pset_fapl_sec2(inner_fapl) < 0) {
+    return NULL;
+  }
+  H5FD_t *inner = H5FDopen(name, flags, inner_fapl, maxaddr);
+  H5Pclose(inner_fapl);
+  if (!inner) {
+    return NULL;
+  }
+
+  NodedupFile *result = (NodedupFile *)calloc(1, sizeof(NodedupFile));
+  if (!result) {
+    H5FDclose(inner);
+    return NULL;
+  }
+  result->inner = inner;
+
+  return &result->pub;
+}
+
+static herr_t nodedup_close(H5FD_t *file) {
+  NodedupFile *nodedup = (NodedupFile *)file;
+  herr_t result = H5FDclose(nodedup->inner);
+  free(nodedup);
+
+  return result;
+}
+
+// NOTE(chogan): Orders by address, so a file only ever matches itself
+static int nodedup_cmp(const H5FD_t *f1, const H5FD_t *f2) {
+  if (f1 < f2) return -1;
+  if (f1 > f2) return 1;
+  return 0;
+}
+
+static herr_t nodedup_query(const H5FD_t *file, unsigned long *flags) {
+  if (!file) {
+    // NOTE(chogan): Driver level query, before any file is open. Same as sec2.
+    *flags = (H5FD_FEAT_AGGREGATE_METADATA | H5FD_FEAT_ACCUMULATE_METADATA |
+              H5FD_FEAT_DATA_SIEVE | H5FD_FEAT_AGGREGATE_SMALLDATA);
+    return 0;
+  }
+
+  return H5FDquery(((const NodedupFile *)file)->inner, flags) < 0 ? -1 : 0;
+}
+
+static haddr_t nodedup_get_eoa(const H5FD_t *file, H5FD_mem_t type) {
+  return H5FDget_eoa(((const NodedupFile *)file)->inner, type);
+}
+
+static herr_t nodedup_set_eoa(H5FD_t *file, H5FD_mem_t type, haddr_t addr) {
+  return H5FDset_eoa(((NodedupFile *)file)->inner, type, addr);
+}
+
+static haddr_t nodedup_get_eof(const H5FD_t *file, H5FD_mem_t type) {
+  return H5FDget_eof(((const NodedupFile *)file)->inner, type);
+}
+
+static herr_t nodedup_get_handle(H5FD_t *file, hid_t fapl, void **file_handle) {
+  return H5FDget_vfd_handle(((NodedupFile *)file)->inner, fapl, file_handle);
+}
+
+static herr_t nodedup_read(H5FD_t *file, H5FD_mem_t type, hid_t dxpl, haddr_t addr, size_t size,
+                           void *buf) {
+  return H5FDread(((NodedupFile *)file)->inner, type, dxpl, addr, size, buf);
+}
+
+static herr_t nodedup_write(H5FD_t *file, H5FD_mem_t type, hid_t dxpl, haddr_t addr, size_t size,
+                            const void *buf) {
+  return H5FDwrite(((NodedupFile *)file)->inner, type, dxpl, addr, size, buf);
+}
+
+static herr_t nodedup_flush(H5FD_t *file, hid_t dxpl_id, hbool_t closing) {
+  return H5FDflush(((NodedupFile *)file)->inner, dxpl_id, closing);
+}
+
+static herr_t nodedup_truncate(H5FD_t *file, hid_t dxpl_id, hbool_t closing) {
+  return H5FDtruncate(((NodedupFile *)file)->inner, dxpl_id, closing);
+}
+
+static herr_t nodedup_lock(H5FD_t *file, hbool_t rw) {
+  return H5FDlock(((NodedupFile *)file)->inner, rw);
+}
+
+static herr_t nodedup_unlock(H5FD_t *file) {
+  return H5FDunlock(((NodedupFile *)file)->inner);
+}
+
+// NOTE(chogan): sec2 rejects anything beyond the largest off_t
+const haddr_t kNodedupMaxAddr = ((haddr_t)1 << (8 * sizeof(off_t) - 1)) - 1;
+
+static const H5FD_class_t nodedup_class = {
+  "mth5_nodedup",           // name
+  kNodedupMaxAddr,          // maxaddr
+  H5F_CLOSE_WEAK,           // fc_degree
+  NULL,                     // terminate
+  NULL,                     // sb_size
+  NULL,                     // sb_encode
+  NULL,                     // sb_decode
+  0,                        // fapl_size
+  NULL,                     // fapl_get
+  NULL,                     // fapl_copy
+  NULL,                     // fapl_free
+  0,                        // dxpl_size
+  NULL,                     // dxpl_copy
+  NULL,                     // dxpl_free
+  nodedup_open,
+  nodedup_close,
+  nodedup_cmp,
+  nodedup_query,
+  NULL,                     // get_type_map
+  NULL,                     // alloc
+  NULL,                     // free
+  nodedup_get_eoa,
+  nodedup_set_eoa,
+  nodedup_get_eof,
+  nodedup_get_handle,
+  nodedup_read,
+  nodedup_write,
+  nodedup_flush,
+  nodedup_truncate,
+  nodedup_lock,
+  nodedup_unlock,
+  H5FD_FLMAP_DICHOTOMY,
+};
+
+// NOTE(chogan): A file access property list that opens files with their own
+// H5F_shared_t and file descriptor
+static hid_t create_nodedup_fapl() {
+  static hid_t driver_id = -1;
+  if (driver_id < 0) {
+    driver_id = H5FDregister(&nodedup_class);
+    assert(driver_id >= 0);
+  }
+  hid_t result = H5Pcreate(H5P_FILE_ACCESS);
+  assert(result >= 0);
+  assert(H5Pset_driver(result, driver_id, NULL) >= 0);
+
+  return result;
+}
+
+#endif  // MTH5_VFD_H_